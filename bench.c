@@ -0,0 +1,399 @@
+// Throughput benchmarks of shlex.h on a few synthetic corpora.
+//
+// $ make bench
+// $ ./bench [results.csv]
+//
+// The human readable report goes to stdout. If the output file is provided the same results are
+// also written there as CSV, one row per benchmark, so they can be tracked over time.
+#include <stdio.h>
+#include <time.h>
+#define SHLEX_IMPLEMENTATION
+#include "shlex.h"
+
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_THREADS 8
+
+typedef struct {
+    char *items;
+    size_t count;
+    size_t capacity;
+} String_Builder;
+
+static void sb_append(String_Builder *sb, const char *str, size_t n)
+{
+    if (sb->count + n > sb->capacity) {
+        if (sb->capacity == 0) sb->capacity = 1024;
+        while (sb->count + n > sb->capacity) sb->capacity *= 2;
+        sb->items = realloc(sb->items, sb->capacity);
+    }
+    memcpy(sb->items + sb->count, str, n);
+    sb->count += n;
+}
+
+static void sb_append_cstr(String_Builder *sb, const char *cstr)
+{
+    sb_append(sb, cstr, strlen(cstr));
+}
+
+// Counts the allocations shlex makes, so we can report allocations per token
+static size_t allocations = 0;
+
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    (void) ctx;
+    (void) old_size;
+    allocations += 1;
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size)
+{
+    (void) ctx;
+    (void) size;
+    free(ptr);
+}
+
+static const ShlexAllocator counting_allocator = {
+    .realloc = counting_realloc,
+    .free = counting_free,
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// All of the corpora are generated with a fixed seed so the runs are comparable
+static unsigned long long rng_state = 0x5EED;
+
+static unsigned rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned)rng_state;
+}
+
+static void corpus_short_flags(String_Builder *sb, size_t size)
+{
+    static const char *flags[] = {
+        "-O2", "-Wall", "-Wextra", "-c", "-o", "main.o", "-DNDEBUG", "-I.", "-fPIC", "-g", "-std=c11", "-lm",
+    };
+    while (sb->count < size) {
+        sb_append_cstr(sb, flags[rng()%(sizeof(flags)/sizeof(flags[0]))]);
+        sb_append_cstr(sb, " ");
+    }
+}
+
+static void corpus_long_quoted_paths(String_Builder *sb, size_t size)
+{
+    while (sb->count < size) {
+        sb_append_cstr(sb, "'/home/user/My Projects/some very long directory name/");
+        for (int i = rng()%8; i >= 0; --i) sb_append_cstr(sb, "nested folder/");
+        sb_append_cstr(sb, "source file.c' \"/opt/vendor toolchain/include/c++/v1/");
+        for (int i = rng()%8; i >= 0; --i) sb_append_cstr(sb, "bits/");
+        sb_append_cstr(sb, "header.h\" ");
+    }
+}
+
+static void corpus_dense_escapes(String_Builder *sb, size_t size)
+{
+    while (sb->count < size) {
+        sb_append_cstr(sb, "a\\ b\\ c\\\"d\\'e \"x\\\"y\\\\z\\$w\" \\\\\\\\ foo\\ bar\\\\baz ");
+    }
+}
+
+static void corpus_response_file(String_Builder *sb, size_t size)
+{
+    while (sb->count < size) {
+        sb_append_cstr(sb, "clang++ -std=c++20 -O2 -g -fPIC -DPROJECT_VERSION=\\\"1.2.3\\\" -I/usr/include/project");
+        for (int i = rng()%16; i >= 0; --i) sb_append_cstr(sb, " -I'third party/lib'");
+        sb_append_cstr(sb, " -c \"src/some module/file.cpp\" -o build/file.o\n");
+    }
+}
+
+typedef struct {
+    const char *name;
+    double seconds;
+    size_t bytes;
+    size_t tokens;
+    size_t allocations;
+} Bench_Result;
+
+typedef enum {
+    SPLIT_NEXT,
+    SPLIT_VIEW,
+    SPLIT_ARGV,
+    SPLIT_LINES,
+    SPLIT_LINES_PARALLEL,
+    SPLIT_PARALLEL,
+    SPLIT_INDEX,
+    SPLIT_STREAM,
+    SPLIT_INTERNED,
+} Split_Mode;
+
+static void count_command(void *ctx, char **argv, size_t argc)
+{
+    (void) argv;
+    *(size_t*)ctx += argc;
+}
+
+static Bench_Result bench_split(const char *name, String_Builder corpus, Split_Mode mode)
+{
+    Bench_Result result = { .name = name };
+    allocations = 0;
+
+    Shlex s = {0};
+    s.allocator = &counting_allocator;
+    ShlexArgv argv = {0};
+    argv.allocator = &counting_allocator;
+    ShlexLines lines = {0};
+    lines.allocator = &counting_allocator;
+    ShlexStream st;
+    shlex_stream_init(&st, count_command, &result.tokens);
+    st.lexer.allocator = &counting_allocator;
+    ShlexIntern intern = {0};
+    intern.allocator = &counting_allocator;
+
+    double start = now_seconds();
+    do {
+        const char *source = corpus.items;
+        const char *source_end = corpus.items + corpus.count;
+        switch (mode) {
+        case SPLIT_NEXT:
+            shlex_init(&s, source, source_end);
+            while (shlex_next(&s)) result.tokens += 1;
+            break;
+        case SPLIT_VIEW: {
+            const char *ptr;
+            size_t len;
+            shlex_init(&s, source, source_end);
+            while (shlex_next_view(&s, &ptr, &len)) result.tokens += 1;
+        } break;
+        case SPLIT_ARGV:
+            shlex_split(source, source_end, &argv);
+            result.tokens += argv.count;
+            break;
+        case SPLIT_LINES:
+        case SPLIT_LINES_PARALLEL:
+            shlex_split_lines(source, source_end, mode == SPLIT_LINES ? 1 : BENCH_THREADS, &lines);
+            for (size_t i = 0; i < lines.parts_count; ++i) {
+                // Not counting the NULLs at the end of each line
+                result.tokens += lines.parts[i].count;
+            }
+            result.tokens -= lines.lines_count;
+            break;
+        case SPLIT_INDEX: {
+            ShlexIndexEntry entries[256];
+            size_t count;
+            shlex_init(&s, source, source_end);
+            do {
+                count = shlex_index(&s, entries, 256);
+                result.tokens += count;
+            } while (count == 256);
+        } break;
+        case SPLIT_PARALLEL:
+            shlex_split_parallel(source, source_end, BENCH_THREADS, &argv);
+            result.tokens += argv.count;
+            break;
+        case SPLIT_STREAM:
+            // As if the corpus was arriving over a connection one full read buffer at a time
+            shlex_stream_reset(&st);
+            for (const char *chunk = source; chunk < source_end; chunk += SHLEX_STREAM_BUFFER_SIZE) {
+                size_t size = source_end - chunk < SHLEX_STREAM_BUFFER_SIZE ? source_end - chunk : SHLEX_STREAM_BUFFER_SIZE;
+                shlex_stream_on_data(&st, chunk, size);
+            }
+            shlex_stream_on_eof(&st);
+            break;
+        case SPLIT_INTERNED: {
+            size_t id;
+            shlex_init(&s, source, source_end);
+            while (shlex_next_interned(&s, &intern, &id)) result.tokens += 1;
+        } break;
+        }
+        result.bytes += corpus.count;
+        result.seconds = now_seconds() - start;
+    } while (result.seconds < BENCH_MIN_SECONDS);
+
+    result.allocations = allocations;
+    shlex_free(&s);
+    shlex_argv_free(&argv);
+    shlex_lines_free(&lines);
+    shlex_stream_free(&st);
+    shlex_intern_free(&intern);
+    return result;
+}
+
+static Bench_Result bench_join(const char *name, char **args, size_t args_count, ShlexQuoting quoting, bool cached)
+{
+    Bench_Result result = { .name = name };
+    allocations = 0;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < args_count; ++i) bytes += strlen(args[i]);
+
+    ShlexQuoteCache cache = {0};
+    cache.allocator = &counting_allocator;
+    Shlex s = {0};
+    s.allocator = &counting_allocator;
+    s.quoting = quoting;
+    if (cached) s.quote_cache = &cache;
+    double start = now_seconds();
+    do {
+        shlex_join_argv(&s, args, args_count);
+        result.tokens += args_count;
+        result.bytes += bytes;
+        result.seconds = now_seconds() - start;
+    } while (result.seconds < BENCH_MIN_SECONDS);
+
+    result.allocations = allocations;
+    shlex_free(&s);
+    shlex_quote_cache_free(&cache);
+    return result;
+}
+
+#define BATCH_COUNT 1024
+
+// Joins many small argvs of 3 to 10 arguments each either one by one or all of them with shlex_join_batch(..)
+static Bench_Result bench_join_many(const char *name, char ***argvs, size_t *argcs, bool batch, bool cached)
+{
+    Bench_Result result = { .name = name };
+    allocations = 0;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < BATCH_COUNT; ++i) {
+        for (size_t j = 0; j < argcs[i]; ++j) bytes += strlen(argvs[i][j]);
+    }
+
+    static size_t offsets[BATCH_COUNT + 1];
+    ShlexQuoteCache cache = {0};
+    cache.allocator = &counting_allocator;
+    Shlex s = {0};
+    s.allocator = &counting_allocator;
+    if (cached) s.quote_cache = &cache;
+    double start = now_seconds();
+    do {
+        if (batch) {
+            shlex_join_batch(&s, argvs, argcs, BATCH_COUNT, offsets);
+        } else {
+            for (size_t i = 0; i < BATCH_COUNT; ++i) shlex_join_argv(&s, argvs[i], argcs[i]);
+        }
+        result.tokens += BATCH_COUNT;
+        result.bytes += bytes;
+        result.seconds = now_seconds() - start;
+    } while (result.seconds < BENCH_MIN_SECONDS);
+
+    result.allocations = allocations;
+    shlex_free(&s);
+    shlex_quote_cache_free(&cache);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char *output_path = argc > 1 ? argv[1] : NULL;
+
+    String_Builder short_flags = {0};
+    corpus_short_flags(&short_flags, 8*1024*1024);
+    String_Builder long_quoted_paths = {0};
+    corpus_long_quoted_paths(&long_quoted_paths, 8*1024*1024);
+    String_Builder dense_escapes = {0};
+    corpus_dense_escapes(&dense_escapes, 8*1024*1024);
+    String_Builder response_file = {0};
+    corpus_response_file(&response_file, 32*1024*1024);
+
+    // Arguments full of single-quotes which are the worst case of shlex_append_quoted_sized(..)
+    static char quote_heavy[1024][128];
+    char *quote_heavy_args[1024];
+    for (size_t i = 0; i < 1024; ++i) {
+        for (size_t j = 0; j + 1 < sizeof(quote_heavy[i]); ++j) {
+            quote_heavy[i][j] = "it's a 'quoted' string"[rng()%22];
+        }
+        quote_heavy_args[i] = quote_heavy[i];
+    }
+
+    // Long paths that need no quoting at all
+    static char plain_paths[1024][256];
+    char *plain_paths_args[1024];
+    for (size_t i = 0; i < 1024; ++i) {
+        for (size_t j = 0; j + 1 < sizeof(plain_paths[i]); ++j) {
+            plain_paths[i][j] = "abcdefghijklmnopqrstuvwxyz0123456789/._-"[rng()%40];
+        }
+        plain_paths_args[i] = plain_paths[i];
+    }
+
+    // The same few flags full of quotes and spaces over and over, like the command line of every translation unit
+    static const char *recurring[] = {
+        "-DPROJECT_NAME=\"shlex demo\"", "-I/opt/vendor's sdk/include", "-DGREETING='Hello, World!'",
+        "-Wl,-rpath,$ORIGIN/../lib", "-DPATH_SEP=\"\\\\\"", "-o", "build/main.o",
+    };
+    char *recurring_args[1024];
+    for (size_t i = 0; i < 1024; ++i) recurring_args[i] = (char*)recurring[rng()%(sizeof(recurring)/sizeof(recurring[0]))];
+
+    // Small argvs like the ones a job scheduler would spawn
+    static const char *small_args[] = {
+        "make", "-j8", "--directory=build", "CFLAGS=-O2 -g", "it's", "/usr/bin/env", "-C", "out dir", "--verbose", "x",
+    };
+    static char *small_argvs_items[BATCH_COUNT][10];
+    char **small_argvs[BATCH_COUNT];
+    size_t small_argcs[BATCH_COUNT];
+    for (size_t i = 0; i < BATCH_COUNT; ++i) {
+        small_argcs[i] = 3 + rng()%8;
+        for (size_t j = 0; j < small_argcs[i]; ++j) {
+            small_argvs_items[i][j] = (char*)small_args[rng()%(sizeof(small_args)/sizeof(small_args[0]))];
+        }
+        small_argvs[i] = small_argvs_items[i];
+    }
+
+    Bench_Result results[] = {
+        bench_split("split_short_flags",         short_flags,       SPLIT_NEXT),
+        bench_split("split_view_short_flags",    short_flags,       SPLIT_VIEW),
+        bench_split("split_argv_short_flags",    short_flags,       SPLIT_ARGV),
+        bench_split("index_short_flags",         short_flags,       SPLIT_INDEX),
+        bench_split("split_long_quoted_paths",   long_quoted_paths, SPLIT_NEXT),
+        bench_split("split_dense_escapes",       dense_escapes,     SPLIT_NEXT),
+        bench_split("split_response_file",       response_file,     SPLIT_NEXT),
+        bench_split("index_response_file",       response_file,     SPLIT_INDEX),
+        bench_split("split_argv_response_file",  response_file,     SPLIT_ARGV),
+        bench_split("split_lines_response_file", response_file,     SPLIT_LINES),
+        bench_split("split_lines_parallel",      response_file,     SPLIT_LINES_PARALLEL),
+        bench_split("split_parallel",            response_file,     SPLIT_PARALLEL),
+        bench_split("stream_response_file",      response_file,     SPLIT_STREAM),
+        bench_split("interned_response_file",    response_file,     SPLIT_INTERNED),
+        bench_join("join_quote_heavy",                   quote_heavy_args, 1024, SHLEX_QUOTE_SINGLE, false),
+        bench_join("join_quote_heavy_minimal",           quote_heavy_args, 1024, SHLEX_QUOTE_MINIMAL, false),
+        bench_join("join_plain_paths",                   plain_paths_args, 1024, SHLEX_QUOTE_SINGLE, false),
+        bench_join("join_recurring_minimal",             recurring_args,   1024, SHLEX_QUOTE_MINIMAL, false),
+        bench_join("join_recurring_minimal_cached",      recurring_args,   1024, SHLEX_QUOTE_MINIMAL, true),
+        bench_join_many("join_small_argvs",              small_argvs,      small_argcs, false, false),
+        bench_join_many("join_small_argvs_cached",       small_argvs,      small_argcs, false, true),
+        bench_join_many("join_batch_small_argvs",        small_argvs,      small_argcs, true, false),
+    };
+    size_t results_count = sizeof(results)/sizeof(results[0]);
+
+    printf("%-28s %12s %14s %16s\n", "benchmark", "MB/s", "tokens/s", "allocs/token");
+    for (size_t i = 0; i < results_count; ++i) {
+        Bench_Result r = results[i];
+        printf("%-28s %12.1f %14.0f %16.6f\n", r.name,
+               r.bytes/r.seconds/1e6, r.tokens/r.seconds, (double)r.allocations/r.tokens);
+    }
+
+    if (output_path != NULL) {
+        FILE *f = fopen(output_path, "w");
+        if (f == NULL) {
+            fprintf(stderr, "ERROR: could not open %s\n", output_path);
+            return 1;
+        }
+        fprintf(f, "benchmark,seconds,bytes,tokens,allocations,mb_per_second,tokens_per_second,allocations_per_token\n");
+        for (size_t i = 0; i < results_count; ++i) {
+            Bench_Result r = results[i];
+            fprintf(f, "%s,%f,%zu,%zu,%zu,%f,%f,%f\n", r.name, r.seconds, r.bytes, r.tokens, r.allocations,
+                    r.bytes/r.seconds/1e6, r.tokens/r.seconds, (double)r.allocations/r.tokens);
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
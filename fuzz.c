@@ -0,0 +1,762 @@
+// Differential fuzzing of shlex.h against a plain byte by byte reference of its lexing rules.
+//
+// $ make fuzz
+// $ ./fuzz corpus/
+//
+// Or without libFuzzer, running random inputs and timing the pathological ones:
+//
+// $ make fuzz_standalone
+// $ ./fuzz_standalone [inputs...]
+//
+// Every split mode (shlex_next, shlex_next_view, streaming, shlex_index, shlex_split, shlex_split_lines,
+// shlex_split_parallel) must produce exactly the tokens, positions and errors of the reference, and every
+// join mode must produce the same command line which splits back into the original arguments. The lexing
+// functions that support comments and punctuation are also checked with all of the combinations of them.
+//
+// The reference follows the POSIX rules shlex.h implements, which is what Python's shlex.split(..) does in
+// the POSIX mode except for a couple of escapes inside of the double-quotes: shlex.h keeps the special
+// meaning of <backslash> before $ and ` there as a shell would.
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <pthread.h>
+#    include <signal.h>
+#    include <sys/time.h>
+#    include <unistd.h>
+#endif // _WIN32
+#define SHLEX_IMPLEMENTATION
+#include "shlex.h"
+
+#define FUZZ_MAX_ARGS 64
+
+static void expect(bool condition, const char *what)
+{
+    if (!condition) {
+        fprintf(stderr, "MISMATCH: %s\n", what);
+        abort();
+    }
+}
+
+// The tokens of the input split by the reference
+typedef struct {
+    char *data;          // The unquoted tokens NULL-terminated one after another
+    size_t *offsets;     // The beginning of each token in data
+    size_t *lens;
+    size_t *starts;      // The boundaries of each token in the source
+    size_t *ends;
+    size_t *lines;       // The 1-based line and byte column of each token start
+    size_t *columns;
+    size_t count;
+    ShlexError error;
+    size_t error_offset;
+    bool comments;       // The Shlex.comments and Shlex.punctuation the tokens are split with
+    bool punctuation;
+} Reference;
+
+static bool reference_is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static bool reference_is_punct(char c)
+{
+    return c != '\0' && strchr("();<>|&", c) != NULL;
+}
+
+static void reference_split(Reference *ref, const char *source, size_t n, bool comments, bool punctuation)
+{
+    // No token takes more than its source plus the NULL-terminator, and the punctuation may split every byte
+    size_t max_tokens = n + 1;
+    ref->data = malloc(2*n + 1);
+    ref->offsets = malloc(max_tokens*sizeof(size_t));
+    ref->lens = malloc(max_tokens*sizeof(size_t));
+    ref->starts = malloc(max_tokens*sizeof(size_t));
+    ref->ends = malloc(max_tokens*sizeof(size_t));
+    ref->lines = malloc(max_tokens*sizeof(size_t));
+    ref->columns = malloc(max_tokens*sizeof(size_t));
+    ref->count = 0;
+    ref->error = SHLEX_OK;
+    ref->error_offset = 0;
+    ref->comments = comments;
+    ref->punctuation = punctuation;
+
+    size_t d = 0;
+    size_t line = 1;
+    size_t line_start = 0;
+    bool in_token = false;
+    bool in_punct = false;
+    bool escaped = false;
+    char strlit = 0;
+    size_t strlit_start = 0;
+    for (size_t i = 0; i <= n; ++i) {
+        // The whitespace, comments and punctuation inside of the quotes or after a <backslash> are a part of the token
+        bool plain = i < n && strlit == 0 && !escaped;
+        bool space = plain && reference_is_space(source[i]);
+        bool comment = plain && comments && source[i] == '#';
+        bool punct = plain && punctuation && reference_is_punct(source[i]);
+        if (i == n || space || comment || punct != in_punct) {
+            if (in_token) {
+                if (i == n) {
+                    if (strlit != 0) {
+                        ref->error = strlit == '\'' ? SHLEX_ERROR_UNTERMINATED_SINGLE_QUOTE : SHLEX_ERROR_UNTERMINATED_DOUBLE_QUOTE;
+                        ref->error_offset = strlit_start;
+                    } else if (escaped) {
+                        ref->error = SHLEX_ERROR_TRAILING_BACKSLASH;
+                        ref->error_offset = n - 1;
+                    }
+                    if (escaped && strlit == '"') ref->data[d++] = '\\';
+                }
+                ref->lens[ref->count] = d - ref->offsets[ref->count];
+                ref->ends[ref->count] = i;
+                ref->count += 1;
+                ref->data[d++] = '\0';
+                in_token = false;
+                in_punct = false;
+            }
+        }
+        if (i == n) break;
+        if (comment) {
+            // The newline itself is left to be the whitespace
+            while (i + 1 < n && source[i + 1] != '\n') i++;
+            continue;
+        }
+        if (space) {
+            if (source[i] == '\n') {
+                line += 1;
+                line_start = i + 1;
+            }
+            continue;
+        }
+
+        char c = source[i];
+        if (!in_token) {
+            in_token = true;
+            in_punct = punct;
+            ref->offsets[ref->count] = d;
+            ref->starts[ref->count] = i;
+            ref->lines[ref->count] = line;
+            ref->columns[ref->count] = i - line_start + 1;
+        }
+        if (c == '\n') {
+            line += 1;
+            line_start = i + 1;
+        }
+
+        if (escaped) {
+            escaped = false;
+            if (strlit == '"' && c != '$' && c != '`' && c != '\\' && c != '\n' && c != '"') ref->data[d++] = '\\';
+            ref->data[d++] = c;
+        } else if (strlit == '\'') {
+            if (c == '\'') strlit = 0; else ref->data[d++] = c;
+        } else if (c == '\\') {
+            escaped = true;
+        } else if (strlit == '"') {
+            if (c == '"') strlit = 0; else ref->data[d++] = c;
+        } else if (c == '\'' || c == '"') {
+            strlit = c;
+            strlit_start = i;
+        } else {
+            ref->data[d++] = c;
+        }
+    }
+}
+
+static void reference_free(Reference *ref)
+{
+    free(ref->data);
+    free(ref->offsets);
+    free(ref->lens);
+    free(ref->starts);
+    free(ref->ends);
+    free(ref->lines);
+    free(ref->columns);
+}
+
+static void expect_token(const Reference *ref, size_t i, const char *token, size_t len, const char *what)
+{
+    expect(i < ref->count, what);
+    expect(len == ref->lens[i], what);
+    expect(memcmp(token, ref->data + ref->offsets[i], len) == 0, what);
+}
+
+static void check_next(const Reference *ref, const char *source, size_t n)
+{
+    Shlex s = {0};
+    s.track_lines = true;
+    s.comments = ref->comments;
+    s.punctuation = ref->punctuation;
+    shlex_init(&s, source, source + n);
+    size_t i = 0;
+    while (shlex_next(&s)) {
+        expect_token(ref, i, s.string, s.string_count - 1, "shlex_next token");
+        expect(strlen(s.string) <= ref->lens[i], "shlex_next NULL-terminator");
+        expect(s.token_start == ref->starts[i] && s.token_end == ref->ends[i], "shlex_next offsets");
+        expect(s.token_line == ref->lines[i] && s.token_column == ref->columns[i], "shlex_next line and column");
+        i += 1;
+    }
+    expect(i == ref->count, "shlex_next count");
+    expect(s.error == ref->error && s.error_offset == ref->error_offset, "shlex_next error");
+#ifdef SHLEX_STATS
+    ShlexStats stats = shlex_stats(&s);
+    expect(stats.tokens == ref->count && stats.bytes_scanned == n, "shlex_stats of shlex_next");
+#endif // SHLEX_STATS
+
+    const char *ptr;
+    size_t len;
+    shlex_init(&s, source, source + n);
+    i = 0;
+    while (shlex_next_view(&s, &ptr, &len)) {
+        expect_token(ref, i, ptr, len, "shlex_next_view token");
+        expect(s.token_start == ref->starts[i] && s.token_end == ref->ends[i], "shlex_next_view offsets");
+        i += 1;
+    }
+    expect(i == ref->count, "shlex_next_view count");
+    expect(s.error == ref->error && s.error_offset == ref->error_offset, "shlex_next_view error");
+#ifdef SHLEX_STATS
+    // The counters go on from the shlex_next(..) above, since shlex_init(..) doesn't reset them
+    stats = shlex_stats(&s);
+    expect(stats.tokens == 2*ref->count && stats.bytes_scanned == 2*n, "shlex_stats of shlex_next_view");
+#endif // SHLEX_STATS
+    shlex_free(&s);
+}
+
+static void check_stream(const Reference *ref, const char *source, size_t n, size_t chunk, bool view)
+{
+    Shlex s = {0};
+    s.track_lines = true;
+    s.comments = ref->comments;
+    s.punctuation = ref->punctuation;
+    size_t i = 0;
+    size_t fed = 0;
+    for (;;) {
+        const char *ptr;
+        size_t len;
+        bool found;
+        if (view) {
+            found = shlex_next_view(&s, &ptr, &len);
+        } else {
+            ptr = shlex_next(&s);
+            found = ptr != NULL;
+            len = found ? s.string_count - 1 : 0;
+        }
+        if (found) {
+            expect_token(ref, i, ptr, len, "streaming token");
+            expect(s.token_start == ref->starts[i] && s.token_end == ref->ends[i], "streaming offsets");
+            expect(s.token_line == ref->lines[i] && s.token_column == ref->columns[i], "streaming line and column");
+            i += 1;
+        } else if (fed < n) {
+            size_t size = n - fed < chunk ? n - fed : chunk;
+            shlex_feed(&s, source + fed, size);
+            fed += size;
+        } else if (!s.finished) {
+            shlex_finish(&s);
+        } else {
+            break;
+        }
+    }
+    expect(i == ref->count, "streaming count");
+    expect(s.error == ref->error && s.error_offset == ref->error_offset, "streaming error");
+    shlex_free(&s);
+}
+
+static void check_index(const Reference *ref, const char *source, size_t n)
+{
+    // A tiny capacity so the indexing is resumed a lot
+    ShlexIndexEntry entries[3];
+    Shlex s = {0};
+    shlex_init(&s, source, source + n);
+    size_t i = 0;
+    size_t count;
+    do {
+        count = shlex_index(&s, entries, 3);
+        for (size_t j = 0; j < count; ++j, ++i) {
+            expect(i < ref->count, "shlex_index count");
+            expect(entries[j].start == ref->starts[i] && entries[j].end == ref->ends[i], "shlex_index offsets");
+            expect(entries[j].needs_unescape == (entries[j].end - entries[j].start != ref->lens[i]), "shlex_index needs_unescape");
+            const char *token = shlex_decode(&s, &entries[j]);
+            expect_token(ref, i, token, s.string_count - 1, "shlex_decode token");
+        }
+    } while (count == 3);
+    expect(i == ref->count, "shlex_index count");
+    // shlex_decode(..) of the last token must not have touched the error found by shlex_index(..) either
+    expect(s.error == ref->error && s.error_offset == ref->error_offset, "shlex_index error");
+    shlex_free(&s);
+}
+
+// The tokens may contain the NULL bytes, so the NULL-terminated ones are compared with the known length
+static void expect_cstr_token(const Reference *ref, size_t i, const char *token, const char *what)
+{
+    expect(i < ref->count, what);
+    expect_token(ref, i, token, ref->lens[i], what);
+    expect(token[ref->lens[i]] == '\0', what);
+}
+
+static void check_argv(const Reference *ref, char **items, size_t count, const char *what)
+{
+    expect(count == ref->count, what);
+    expect(items[count] == NULL, what);
+    for (size_t i = 0; i < count; ++i) expect_cstr_token(ref, i, items[i], what);
+}
+
+// The counting allocator is not thread-safe, and must only be called on the thread checking the splits
+static size_t fuzz_allocs;
+static _Thread_local bool fuzz_checking_thread;
+
+static void *fuzz_counting_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    (void) ctx;
+    (void) old_size;
+    expect(fuzz_checking_thread, "ShlexArgv.allocator is only called on the splitting thread");
+    fuzz_allocs += 1;
+    return realloc(ptr, new_size);
+}
+
+static void fuzz_counting_free(void *ctx, void *ptr, size_t size)
+{
+    (void) ctx;
+    (void) size;
+    expect(fuzz_checking_thread, "ShlexArgv.allocator is only called on the splitting thread");
+    free(ptr);
+}
+
+static const ShlexAllocator fuzz_counting_allocator = { fuzz_counting_realloc, fuzz_counting_free, NULL };
+
+static void check_split(const Reference *ref, const char *source, size_t n)
+{
+    ShlexArgv argv = { .allocator = &fuzz_counting_allocator };
+    fuzz_checking_thread = true;
+    fuzz_allocs = 0;
+    shlex_split(source, source + n, &argv);
+    check_argv(ref, argv.items, argv.count, "shlex_split");
+    expect(fuzz_allocs <= 2, "shlex_split makes at most two allocations");
+
+    for (size_t threads = 1; threads <= 4; ++threads) {
+        shlex_split_parallel(source, source + n, threads, &argv);
+        check_argv(ref, argv.items, argv.count, "shlex_split_parallel");
+    }
+    shlex_argv_free(&argv);
+
+    // The unquoted newlines only separate the lines, so all of the lines together have the same tokens
+    ShlexLines lines = {0};
+    for (size_t threads = 1; threads <= 3; threads += 2) {
+        shlex_split_lines(source, source + n, threads, &lines);
+        size_t i = 0;
+        for (size_t line = 0; line < lines.lines_count; ++line) {
+            for (char **item = lines.lines[line]; *item != NULL; ++item, ++i) {
+                expect_cstr_token(ref, i, *item, "shlex_split_lines");
+            }
+        }
+        expect(i == ref->count, "shlex_split_lines count");
+    }
+    shlex_lines_free(&lines);
+}
+
+typedef struct {
+    char *data;
+    size_t count;
+} Fuzz_Buffer;
+
+static bool fuzz_buffer_write(void *ctx, const char *data, size_t size)
+{
+    Fuzz_Buffer *buffer = ctx;
+    memcpy(buffer->data + buffer->count, data, size);
+    buffer->count += size;
+    return true;
+}
+
+#ifndef _WIN32
+// The joined command lines of the inputs up to this long fit into a pipe, so they are read after all of the writing
+#define FUZZ_PIPE_CAPACITY 4096
+
+static void check_join_fd(char **args, size_t args_count, ShlexQuoting quoting, const char *joined, size_t joined_len)
+{
+    if (joined_len >= FUZZ_PIPE_CAPACITY) return;
+    int fds[2];
+    expect(pipe(fds) == 0, "pipe");
+    expect(shlex_join_fd(fds[1], args, args_count, quoting), "shlex_join_fd");
+    close(fds[1]);
+    char buffer[FUZZ_PIPE_CAPACITY];
+    size_t count = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buffer + count, sizeof(buffer) - count)) > 0) count += n;
+    close(fds[0]);
+    expect(count == joined_len && memcmp(buffer, joined, joined_len) == 0, "shlex_join_fd");
+}
+#endif // _WIN32
+
+// The input is a bunch of arguments separated by the NULL bytes which must survive joining and splitting back
+// Shared by all of the inputs, so the arguments of the previous ones are hit too
+static ShlexQuoteCache fuzz_quote_cache;
+
+static void check_join(const char *source, size_t n)
+{
+    char *copy = malloc(n + 1);
+    memcpy(copy, source, n);
+    copy[n] = '\0';
+    char *args[FUZZ_MAX_ARGS + 1];
+    size_t args_count = 0;
+    for (char *arg = copy; arg <= copy + n && args_count < FUZZ_MAX_ARGS; arg += strlen(arg) + 1) {
+        args[args_count++] = arg;
+    }
+    args[args_count] = NULL;
+
+    for (int quoting = SHLEX_QUOTE_SINGLE; quoting <= SHLEX_QUOTE_MINIMAL; ++quoting) {
+        Shlex s = {0};
+        s.quoting = quoting;
+        char *joined = strdup(shlex_join_argv(&s, args, args_count));
+        size_t joined_len = strlen(joined);
+
+        size_t quoted_len = 0;
+        for (size_t i = 0; i < args_count; ++i) {
+            quoted_len += (i > 0) + shlex_quoted_len_with(args[i], strlen(args[i]), quoting);
+        }
+        expect(quoted_len == joined_len, "shlex_quoted_len_with");
+
+        for (size_t i = 0; i < args_count; ++i) shlex_append_quoted(&s, args[i]);
+        expect(strcmp(shlex_join(&s), joined) == 0, "shlex_append_quoted");
+
+        // The first round fills the cache and the second one must hit the same quoted forms
+        s.quote_cache = &fuzz_quote_cache;
+        for (int round = 0; round < 2; ++round) {
+            for (size_t i = 0; i < args_count; ++i) shlex_append_quoted(&s, args[i]);
+            expect(strcmp(shlex_join(&s), joined) == 0, "shlex_append_quoted with the quote cache");
+        }
+        s.quote_cache = NULL;
+
+        char **argvs[2] = {args, args};
+        size_t offsets[3];
+        char *batch = shlex_join_batch(&s, argvs, NULL, 2, offsets);
+        expect(strcmp(batch + offsets[0], joined) == 0 && strcmp(batch + offsets[1], joined) == 0, "shlex_join_batch");
+
+        Fuzz_Buffer buffer = { .data = malloc(joined_len + 1) };
+        shlex_join_to(args, args_count, quoting, fuzz_buffer_write, &buffer);
+        expect(buffer.count == joined_len && memcmp(buffer.data, joined, joined_len) == 0, "shlex_join_to");
+        free(buffer.data);
+#ifndef _WIN32
+        check_join_fd(args, args_count, quoting, joined, joined_len);
+#endif // _WIN32
+
+        Reference ref;
+        reference_split(&ref, joined, joined_len, false, false);
+        expect(ref.count == args_count, "joined count");
+        expect(ref.error == SHLEX_OK, "joined error");
+        for (size_t i = 0; i < args_count; ++i) {
+            expect(ref.lens[i] == strlen(args[i]) && strcmp(ref.data + ref.offsets[i], args[i]) == 0, "joined round trip");
+        }
+        check_next(&ref, joined, joined_len);
+        reference_free(&ref);
+
+        free(joined);
+        shlex_free(&s);
+    }
+    free(copy);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const char *source = (const char*)data;
+    Reference ref;
+    reference_split(&ref, source, size, false, false);
+    check_next(&ref, source, size);
+    check_stream(&ref, source, size, 1, false);
+    check_stream(&ref, source, size, 1 + size%7, true);
+    check_stream(&ref, source, size, size > 0 ? 1 + data[0]%64 : 1, false);
+    check_index(&ref, source, size);
+    check_split(&ref, source, size);
+    reference_free(&ref);
+    for (int flags = 1; flags < 4; ++flags) {
+        reference_split(&ref, source, size, flags & 1, flags & 2);
+        check_next(&ref, source, size);
+        check_stream(&ref, source, size, 1, false);
+        check_stream(&ref, source, size, 1 + size%7, true);
+        reference_free(&ref);
+    }
+    check_join(source, size);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static unsigned long long rng_state = 0x5EED;
+
+static unsigned rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned)rng_state;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Inputs made of the characters the lexer cares about, so the random ones hit all of the corners
+static void fuzz_random(size_t iterations)
+{
+    static const char alphabet[] = "ab '\"\\\n\t$`#&|(\0\xc3";
+    char input[256];
+    for (size_t i = 0; i < iterations; ++i) {
+        size_t size = rng()%sizeof(input);
+        for (size_t j = 0; j < size; ++j) input[j] = alphabet[rng()%(sizeof(alphabet) - 1)];
+        LLVMFuzzerTestOneInput((const uint8_t*)input, size);
+    }
+    printf("%zu random inputs OK\n", iterations);
+}
+
+typedef struct {
+    const char *name;
+    const char *pattern;
+} Pathological_Input;
+
+typedef enum {
+    TIME_NEXT,
+    TIME_VIEW,
+    TIME_STREAM,
+    TIME_INDEX,
+    TIME_SPLIT,
+    TIME_PARALLEL,
+    TIME_JOIN,
+    TIME_COUNT,
+} Time_Mode;
+
+static const char *time_mode_names[TIME_COUNT] = {
+    [TIME_NEXT]     = "next",
+    [TIME_VIEW]     = "view",
+    [TIME_STREAM]   = "stream",
+    [TIME_INDEX]    = "index",
+    [TIME_SPLIT]    = "split",
+    [TIME_PARALLEL] = "parallel",
+    [TIME_JOIN]     = "join",
+};
+
+static double time_mode(Time_Mode mode, const char *source, size_t n)
+{
+    double start = now_seconds();
+    Shlex s = {0};
+    ShlexArgv argv = {0};
+    switch (mode) {
+    case TIME_NEXT:
+        shlex_init(&s, source, source + n);
+        while (shlex_next(&s)) {}
+        break;
+    case TIME_VIEW: {
+        const char *ptr;
+        size_t len;
+        shlex_init(&s, source, source + n);
+        while (shlex_next_view(&s, &ptr, &len)) {}
+    } break;
+    case TIME_STREAM:
+        for (size_t i = 0; i < n; i += 4096) {
+            shlex_feed(&s, source + i, n - i < 4096 ? n - i : 4096);
+            while (shlex_next(&s)) {}
+        }
+        shlex_finish(&s);
+        while (shlex_next(&s)) {}
+        break;
+    case TIME_INDEX: {
+        ShlexIndexEntry entries[256];
+        shlex_init(&s, source, source + n);
+        while (shlex_index(&s, entries, 256) == 256) {}
+    } break;
+    case TIME_SPLIT:
+        shlex_split(source, source + n, &argv);
+        break;
+    case TIME_PARALLEL:
+        shlex_split_parallel(source, source + n, 4, &argv);
+        break;
+    case TIME_JOIN: {
+        char *arg = malloc(n + 1);
+        memcpy(arg, source, n);
+        arg[n] = '\0';
+        s.quoting = SHLEX_QUOTE_MINIMAL;
+        shlex_join_argv(&s, &arg, 1);
+        free(arg);
+    } break;
+    case TIME_COUNT:
+        break;
+    }
+    shlex_free(&s);
+    shlex_argv_free(&argv);
+    return now_seconds() - start;
+}
+
+// Times each mode on each input at two sizes. A linear mode takes about 4 times longer on the 4 times bigger
+// input, so anything way above that is reported as superlinear.
+static void time_pathological(void)
+{
+    static const Pathological_Input inputs[] = {
+        {"backslashes",        "\\"},
+        {"escaped_spaces",     "\\ "},
+        {"alternating_quotes", "'\""},
+        {"empty_quotes",       "''\"\" "},
+        {"double_escapes",     "\"\\\\\\\"\""},
+        {"single_quotes",      "'a'"},
+        {"whitespace",         " \t\n"},
+        {"tiny_tokens",        "a "},
+        {"long_token",         "a"},
+    };
+    size_t inputs_count = sizeof(inputs)/sizeof(inputs[0]);
+    size_t small = 1 << 18;
+    size_t big = small*4;
+    char *source = malloc(big);
+
+    bool superlinear = false;
+    printf("%-20s %-10s %12s %12s %8s\n", "input", "mode", "small (s)", "big (s)", "ratio");
+    for (size_t i = 0; i < inputs_count; ++i) {
+        size_t pattern_len = strlen(inputs[i].pattern);
+        for (size_t j = 0; j < big; ++j) source[j] = inputs[i].pattern[j%pattern_len];
+        for (int mode = 0; mode < TIME_COUNT; ++mode) {
+            double small_seconds = time_mode(mode, source, small);
+            double big_seconds = time_mode(mode, source, big);
+            double ratio = big_seconds/(small_seconds > 1e-6 ? small_seconds : 1e-6);
+            bool suspicious = ratio > 16 && big_seconds > 0.01;
+            superlinear = superlinear || suspicious;
+            printf("%-20s %-10s %12.6f %12.6f %8.2f%s\n", inputs[i].name, time_mode_names[mode],
+                   small_seconds, big_seconds, ratio, suspicious ? " SUPERLINEAR" : "");
+        }
+    }
+    free(source);
+    if (superlinear) {
+        fprintf(stderr, "ERROR: some of the modes are superlinear\n");
+        exit(1);
+    }
+}
+
+#ifndef _WIN32
+typedef struct {
+    int fd;
+    char *data;
+    size_t count;
+    size_t capacity;
+} Fuzz_Pipe_Reader;
+
+// Reads the pipe slowly in small pieces, so the writer spends most of the time blocked on the full pipe
+static void *fuzz_read_pipe(void *arg)
+{
+    Fuzz_Pipe_Reader *reader = arg;
+    for (;;) {
+        if (reader->capacity - reader->count < 512) {
+            reader->capacity = reader->capacity == 0 ? 4096 : reader->capacity*2;
+            reader->data = realloc(reader->data, reader->capacity);
+        }
+        ssize_t n = read(reader->fd, reader->data + reader->count, 512);
+        if (n <= 0) break;
+        reader->count += n;
+        usleep(20);
+    }
+    return NULL;
+}
+
+static volatile sig_atomic_t fuzz_alarms;
+
+static void fuzz_on_alarm(int sig)
+{
+    (void) sig;
+    fuzz_alarms += 1;
+}
+
+// Joins a command line way longer than the pipe into it while the alarms keep interrupting the writer without
+// SA_RESTART, so writev(..) gets cut off both before anything is written (EINTR) and in the middle of the pieces.
+static void check_join_fd_interrupted(void)
+{
+    // Every other argument is a long run of the safe characters which goes as a single piece, so the pieces
+    // of a writev(..) outgrow the pipe, and the rest are full of the characters that need quoting
+    static const char alphabet[] = "ab '\"\\\n$`";
+    size_t args_count = 200;
+    char **args = malloc((args_count + 1)*sizeof(*args));
+    for (size_t i = 0; i < args_count; ++i) {
+        size_t n = rng()%(i%2 == 0 ? 20000 : 200);
+        args[i] = malloc(n + 1);
+        for (size_t j = 0; j < n; ++j) args[i][j] = i%2 == 0 ? 'a' : alphabet[rng()%(sizeof(alphabet) - 1)];
+        args[i][n] = '\0';
+    }
+    args[args_count] = NULL;
+    Shlex s = {0};
+    s.quoting = SHLEX_QUOTE_MINIMAL;
+    const char *joined = shlex_join_argv(&s, args, args_count);
+    size_t joined_len = strlen(joined);
+
+    int fds[2];
+    expect(pipe(fds) == 0, "pipe");
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[1], F_SETPIPE_SZ, 4096);
+#endif // F_SETPIPE_SZ
+    struct sigaction action = {0}, old_action;
+    action.sa_handler = fuzz_on_alarm;
+    sigaction(SIGALRM, &action, &old_action);
+
+    // Only the writer may be interrupted, the reader inherits the blocked SIGALRM
+    sigset_t alarm_set;
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
+    Fuzz_Pipe_Reader reader = { .fd = fds[0] };
+    pthread_t thread;
+    expect(pthread_create(&thread, NULL, fuzz_read_pipe, &reader) == 0, "pthread_create");
+    pthread_sigmask(SIG_UNBLOCK, &alarm_set, NULL);
+
+    struct itimerval timer = { .it_interval = { .tv_usec = 50 }, .it_value = { .tv_usec = 50 } };
+    setitimer(ITIMER_REAL, &timer, NULL);
+    bool ok = shlex_join_fd(fds[1], args, args_count, SHLEX_QUOTE_MINIMAL);
+    struct itimerval stop = {0};
+    setitimer(ITIMER_REAL, &stop, NULL);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    sigaction(SIGALRM, &old_action, NULL);
+
+    expect(ok, "shlex_join_fd interrupted");
+    expect(reader.count == joined_len && memcmp(reader.data, joined, joined_len) == 0, "shlex_join_fd interrupted");
+    printf("shlex_join_fd of %zu bytes through a pipe OK, interrupted %d times\n", joined_len, (int)fuzz_alarms);
+
+    free(reader.data);
+    shlex_free(&s);
+    for (size_t i = 0; i < args_count; ++i) free(args[i]);
+    free(args);
+}
+#endif // _WIN32
+
+static bool read_entire_file(const char *path, char **data, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = malloc(length > 0 ? length : 1);
+    *size = fread(*data, 1, length, f);
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // Replaying the given inputs, like the crashes found by libFuzzer
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            char *data;
+            size_t size;
+            if (!read_entire_file(argv[i], &data, &size)) {
+                fprintf(stderr, "ERROR: could not read %s\n", argv[i]);
+                return 1;
+            }
+            LLVMFuzzerTestOneInput((const uint8_t*)data, size);
+            free(data);
+            printf("%s OK\n", argv[i]);
+        }
+        return 0;
+    }
+
+    fuzz_random(100000);
+#ifndef _WIN32
+    check_join_fd_interrupted();
+#endif // _WIN32
+    time_pathological();
+    return 0;
+}
+#endif // FUZZ_STANDALONE
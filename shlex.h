@@ -5,7 +5,117 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
+
+// Makes ShlexPool thread-safe and lets shlex_split_lines(..) and shlex_split_parallel(..) use several threads.
+// Must be defined the same way everywhere shlex.h is included, since it changes the layout of ShlexPool.
+#ifdef SHLEX_THREADS
+#    include <pthread.h>
+#endif // SHLEX_THREADS
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// A custom allocator for all of the memory shlex allocates. Install it by pointing Shlex.allocator
+// or ShlexArgv.allocator at it. When they are NULL, SHLEX_REALLOC(..) and SHLEX_FREE(..) are used
+// which default to realloc(..) and free(..) and can be redefined before including the implementation.
+typedef struct {
+    // Same as realloc(..) but with the user context and the size of the block being resized (0 for ptr == NULL).
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    // May be NULL if the memory is released some other way, like resetting an arena all at once.
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} ShlexAllocator;
+
+// What was wrong with the input. The lexer never stops on errors, it finishes the token the best it can
+// and records the first error in Shlex.error, so the input can be validated in the same pass.
+typedef enum {
+    SHLEX_OK = 0,
+    SHLEX_ERROR_UNTERMINATED_SINGLE_QUOTE,
+    SHLEX_ERROR_UNTERMINATED_DOUBLE_QUOTE,
+    SHLEX_ERROR_TRAILING_BACKSLASH,
+} ShlexError;
+
+// How shlex_append_quoted[_sized](..) quotes the arguments that are not safe as they are.
+typedef enum {
+    // Wraps the whole argument in single-quotes turning each single-quote inside of it into '"'"'
+    SHLEX_QUOTE_SINGLE = 0,
+    // Picks the shortest of single-quotes, double-quotes with \\ \$ \` \" escapes, or a <backslash> before
+    // each unsafe character. Useful for the arguments full of single-quotes like SQL or JSON.
+    SHLEX_QUOTE_MINIMAL,
+} ShlexQuoting;
+
+// The counters of what a Shlex has been doing since it was zeroed or freed, see shlex_stats(..).
+// They are only collected if SHLEX_STATS is defined, which must be defined the same way everywhere shlex.h
+// is included since it changes the layout of Shlex. Otherwise they are compiled out and are always zero.
+typedef struct {
+    size_t bytes_scanned;      // The bytes of the source passed by shlex_next(..), shlex_next_view(..) and shlex_index(..)
+    size_t tokens;             // The tokens they found
+    size_t unescaped_tokens;   // The tokens which had quotes or <backslash>es, so they differ from their raw bytes
+    size_t reallocs;           // The allocations of the string storage, not counting the inline buffer
+    size_t peak_capacity;      // The biggest string_capacity so far
+    size_t quoted_args;        // The arguments of shlex_append_quoted[_sized](..) which needed quoting
+    size_t bare_args;          // The arguments of shlex_append_quoted[_sized](..) which were appended as they are
+    size_t quote_cache_hits;   // The quoted arguments found in Shlex.quote_cache
+    size_t quote_cache_misses; // The quoted arguments that had to be quoted and put into Shlex.quote_cache
+} ShlexStats;
+
+// How the string storage of a Shlex grows and shrinks. All zeros is the default policy: start in the inline
+// buffer, keep doubling the capacity without a limit and never give the memory back on its own.
+typedef struct {
+    size_t initial;    // The capacity of the first heap allocation, if it is enough for what needs to fit
+    size_t percent;    // How much each step grows the capacity by, 0 means 100 which is doubling
+    size_t max_step;   // The biggest single step in bytes, so huge storages grow linearly. 0 means no limit
+    size_t trim_above; // shlex_reset(..) shrinks the storage back to the inline buffer if its capacity is bigger than this.
+                       // 0 means never
+} ShlexGrowth;
+
+// The size of the string storage embedded into the Shlex, so the short tokens never touch the heap.
+#ifndef SHLEX_INLINE_CAPACITY
+#define SHLEX_INLINE_CAPACITY 64
+#endif // SHLEX_INLINE_CAPACITY
+
+// The amount of the entries of a ShlexQuoteCache, must be a power of two, and the longest argument it keeps.
+// So the cache never takes more than about SHLEX_QUOTE_CACHE_ENTRIES*6*SHLEX_QUOTE_CACHE_MAX_SIZE bytes.
+#ifndef SHLEX_QUOTE_CACHE_ENTRIES
+#define SHLEX_QUOTE_CACHE_ENTRIES 64
+#endif // SHLEX_QUOTE_CACHE_ENTRIES
+#ifndef SHLEX_QUOTE_CACHE_MAX_SIZE
+#define SHLEX_QUOTE_CACHE_MAX_SIZE 256
+#endif // SHLEX_QUOTE_CACHE_MAX_SIZE
+
+typedef struct {
+    char *data;         // The argument followed by its quoted form. NULL means the entry is empty
+    size_t capacity;
+    size_t size;        // Of the argument
+    size_t quoted_size;
+    size_t hash;
+    ShlexQuoting quoting;
+} ShlexQuoteCacheEntry;
+
+// The quoted forms of the recurring arguments which need quoting, like the same flags joined into the command
+// line of every translation unit. Direct-mapped by the hash of the argument: a new argument simply replaces
+// whatever was in its entry, so the memory stays bounded. Point Shlex.quote_cache at it to use it. May be shared
+// by many lexers, but not by the threads.
+typedef struct {
+    ShlexQuoteCacheEntry entries[SHLEX_QUOTE_CACHE_ENTRIES];
+
+    // The allocator of the entries. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    const ShlexAllocator *allocator;
+} ShlexQuoteCache;
+
+// Deallocates all of the entries and zeroes out the cache except cache->allocator.
+void shlex_quote_cache_free(ShlexQuoteCache *cache);
+
+// The size of the blocks a ShlexIntern stores its strings in. The longer strings get a block of their own.
+#ifndef SHLEX_INTERN_BLOCK_SIZE
+#define SHLEX_INTERN_BLOCK_SIZE (64*1024)
+#endif // SHLEX_INTERN_BLOCK_SIZE
+
+// The size of the read buffer of a ShlexStream, see shlex_stream_buffer(..).
+#ifndef SHLEX_STREAM_BUFFER_SIZE
+#define SHLEX_STREAM_BUFFER_SIZE (16*1024)
+#endif // SHLEX_STREAM_BUFFER_SIZE
 
 // # The Shlex
 //
@@ -33,19 +143,97 @@
 // printf("%s\n", shlex_join(&s));
 // shlex_free(&s);
 // ```
+//
+// Short strings live in a buffer inside of the Shlex itself, so s.string may point into the struct.
+// Never copy a Shlex by value, pass it around by pointer instead.
 typedef struct {
     // The source which shlex_next(..) is splitting the tokens from.
     const char *source;
     const char *source_end;
     const char *point;
 
+    // The state of the lexer in the middle of a token. It survives between the chunks of shlex_feed(..).
+    char strlit;    // The quote the lexer is currently inside of or 0
+    bool escaped;   // The last character was a <backslash> which escapes the next one
+    bool in_token;  // The token in the string storage is not finished yet
+    bool streaming; // The source is just a chunk of the input, see shlex_feed(..)
+    bool finished;  // There are no more chunks after the current one, see shlex_finish(..)
+    size_t strlit_start; // The offset of the quote that opened strlit from the beginning of the input
+    bool in_comment; // Skipping a comment up to the end of the line, see comments
+    bool in_punct;   // The token in the string storage is a run of punctuation, see punctuation
+
+    // The Python shlex compatible extensions of the lexer, both off by default. They only affect shlex_next(..)
+    // and shlex_next_view(..). Set comments to true to skip everything from an unquoted '#' up to the end of
+    // the line, like commenters="#" does, even in the middle of a word. Set punctuation to true to split out
+    // the runs of unquoted ();<>|& as separate tokens, like punctuation_chars=True does: "a&&b" becomes
+    // "a", "&&" and "b".
+    bool comments;
+    bool punctuation;
+
+    // The first error met since shlex_init(..) or shlex_reset(..) and the offset of the character that caused it
+    // from the beginning of the input: the opening quote or the trailing <backslash>.
+    ShlexError error;
+    size_t error_offset;
+
+    // Where the last token returned by shlex_next(..) or shlex_next_view(..) was found, as the offsets
+    // [token_start, token_end) from the beginning of the input. In the streaming mode they count all of the
+    // chunks fed so far, so a token crossing the chunks still gets its real boundaries.
+    size_t token_start;
+    size_t token_end;
+    // The offset of s->source from the beginning of the input. Grows with each shlex_feed(..).
+    size_t source_offset;
+
+    // Set track_lines to true to also get the 1-based line and byte column of each token start.
+    // The newlines are counted lazily up to the token, so each byte of the input is looked at only once.
+    bool track_lines;
+    size_t token_line;
+    size_t token_column;
+    // How far the newlines are counted, how many of them there were and where the last line starts.
+    const char *line_point;
+    size_t line_count;
+    size_t line_start;
+
     // An automatically growing string storage which is used for returning tokens by shlex_next(..)
     // and collecting joined strings by shlex_append_quoted[_sized](..).
     char *string;
     size_t string_count;
     size_t string_capacity;
+
+    // The allocator of the string storage. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    const ShlexAllocator *allocator;
+
+    // How shlex_append_quoted[_sized](..) quotes the arguments.
+    ShlexQuoting quoting;
+    // When not NULL shlex_append_quoted[_sized](..) looks the arguments which need quoting up here first.
+    ShlexQuoteCache *quote_cache;
+
+    // How the string storage grows and shrinks.
+    ShlexGrowth growth;
+
+#ifdef SHLEX_STATS
+    ShlexStats stats;
+#endif // SHLEX_STATS
+
+    // The string storage starts here and spills to the heap only when it outgrows it.
+    char inline_string[SHLEX_INLINE_CAPACITY];
 } Shlex;
 
+// An argv produced by shlex_split(..). All of the tokens live in a single contiguous buffer.
+typedef struct {
+    // NULL-terminated, so it can be passed to execv(..) and friends directly.
+    char **items;
+    size_t count;
+    size_t items_capacity;
+
+    // The storage of the tokens pointed to by items.
+    char *data;
+    size_t data_capacity;
+
+    // The allocator of items and data. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    // Even shlex_split_parallel(..) calls it only on the calling thread, so it doesn't have to be thread-safe.
+    const ShlexAllocator *allocator;
+} ShlexArgv;
+
 // Sets the source. It also implies shlex_reset(..), so you don't have to call it explicitly.
 void shlex_init(Shlex *s, const char *source, const char *source_end);
 
@@ -53,8 +241,45 @@ void shlex_init(Shlex *s, const char *source, const char *source_end);
 // with NULL-terminator so you can access it via s.string as a C string.
 //
 // It also returns s.string as the result on success. Return NULL means ran out of tokens.
+// Unterminated quotes and a trailing <backslash> don't stop the lexer, check s.error after the last token.
 char *shlex_next(Shlex *s);
 
+// Same as shlex_next(..) but returns the token as a sized view. If the token does not contain any quotes
+// or <backslash>es the view points straight into the source and nothing is copied to the string storage.
+// Otherwise the token is unquoted into the string storage like shlex_next(..) does and the view points there.
+// Either way the view is not NULL-terminated, so use *len. Returns false when ran out of tokens.
+bool shlex_next_view(Shlex *s, const char **ptr, size_t *len);
+
+// Switches the shlex into the streaming mode and sets the next chunk of the input as the source.
+// In the streaming mode shlex_next(..) and shlex_next_view(..) return NULL/false when they need more input:
+// the unfinished token, the quotes and the pending <backslash> are kept in the shlex until the next chunk.
+// The token that is continued in the next chunk accumulates in the string storage, so the chunk itself
+// may be reused once the lexing functions ran out of it. Call shlex_finish(..) when the input is over.
+void shlex_feed(Shlex *s, const char *chunk, size_t len);
+
+// Tells the shlex in the streaming mode that the current chunk is the last one, so the token at the end
+// of it is finished. Keep calling shlex_next(..) after this to get the rest of the tokens.
+void shlex_finish(Shlex *s);
+
+// The boundaries of a token found by shlex_index(..) as offsets relative to Shlex.source.
+typedef struct {
+    size_t start;
+    size_t end;
+    // The token has quotes or <backslash>es, so its raw bytes differ from what shlex_next(..) would return.
+    bool needs_unescape;
+} ShlexIndexEntry;
+
+// Runs the lexer from s->point and writes the boundaries of up to capacity next tokens into entries without
+// touching the string storage. Returns the amount of entries written. If it's less than capacity the source is over,
+// otherwise just call it again to index more. Use shlex_decode(..) to get the tokens you actually need.
+// Records the errors in s.error and s.error_offset the same way shlex_next(..) does.
+// Doesn't support the streaming mode, comments and punctuation.
+size_t shlex_index(Shlex *s, ShlexIndexEntry *entries, size_t capacity);
+
+// Unquotes the token of the entry produced by shlex_index(..) on the same source into the string storage
+// with NULL-terminator and returns it. Doesn't affect the position of s in the source and its errors.
+char *shlex_decode(Shlex *s, const ShlexIndexEntry *entry);
+
 // Resets the state of the shlex removing the source but without deallocating memory of the string
 // storage so it can be reused. You usually wanna use this function before calling
 // shlex_append_quoted[_sized](..) after doing some splitting with shlex_init(..) and shlex_init(..).
@@ -73,202 +298,2909 @@ void shlex_append_quoted_sized(Shlex *s, const char *str, size_t n);
 // strdup(..) it to prolong its lifetime.
 char *shlex_join(Shlex *s);
 
-// Deallocates the memory of the string storage and completely zeroes out the shlex.
+// Computes exactly how many bytes shlex_append_quoted_sized(..) is going to append for str, not counting the separator.
+size_t shlex_quoted_len(const char *str, size_t n);
+
+// Same as shlex_quoted_len(..) but for the given quoting mode instead of SHLEX_QUOTE_SINGLE.
+size_t shlex_quoted_len_with(const char *str, size_t n, ShlexQuoting quoting);
+
+// Appends all of the argv quoted, and finalizes it with shlex_join(..). The size of the result is computed
+// upfront with shlex_quoted_len(..), so the string storage is grown at most once to exactly the required size.
+char *shlex_join_argv(Shlex *s, char **argv, size_t argc);
+
+// Joins count argvs at once into the string storage one after another, each NULL-terminated. The i-th command
+// line starts at offsets[i] in the returned storage, and offsets[count] is where the last one ends, so offsets
+// must have room for count + 1 of them. If argcs is NULL each argv is NULL-terminated instead.
+// Unlike calling shlex_join_argv(..) for each argv, the storage is not sized upfront, so each argument is scanned
+// only once, and the storage of a reused shlex quickly grows enough for the typical batch to need no allocations.
+char *shlex_join_batch(Shlex *s, char **const *argvs, const size_t *argcs, size_t count, size_t *offsets);
+
+// Receives the pieces of a command line joined by shlex_join_to(..) one after another.
+// Returns false to stop the join, for example when writing the output has failed.
+typedef bool (*ShlexWrite)(void *ctx, const char *data, size_t size);
+
+// Same as shlex_join_argv(..) but streams the command line into write(..) instead of building it in the string
+// storage. The safe arguments and the runs between the escapes go straight from argv, only the quotes, the escapes
+// and the separators are written from the constant strings, so nothing is copied or allocated. There is no
+// NULL-terminator at the end. Returns false if write(..) did.
+bool shlex_join_to(char **argv, size_t argc, ShlexQuoting quoting, ShlexWrite write, void *ctx);
+
+#ifndef _WIN32
+// Streams the joined command line into the file descriptor with writev(..) batching the pieces of shlex_join_to(..).
+// Handles partial writes and EINTR. Returns false leaving the reason in errno if writing has failed.
+bool shlex_join_fd(int fd, char **argv, size_t argc, ShlexQuoting quoting);
+#endif // _WIN32
+
+// A memory mapped file which is split into tokens line by line with shlex_next_line(..).
+typedef struct {
+    const char *data;
+    size_t size;
+    // The beginning of the next line
+    const char *point;
+} ShlexFile;
+
+// Maps the whole file into memory without reading it, so the pages are loaded lazily as the lines are split.
+// Returns false on failure leaving the reason in errno (or GetLastError() on Windows).
+bool shlex_open_file(ShlexFile *f, const char *path);
+
+// Chops off the next line of the file and sets it as the source of s with shlex_init(..), so its tokens
+// can be iterated with shlex_next(..) straight from the mapped memory. Returns false when there are no more lines.
+// The lines are separated by each '\n' even if it's inside of the quotes or preceded by a <backslash>.
+bool shlex_next_line(ShlexFile *f, Shlex *s);
+
+// Unmaps the file and zeroes out f. The tokens returned by shlex_next_view(..) are invalidated.
+void shlex_close_file(ShlexFile *f);
+
+// Splits the whole [source, source_end) into argv in a single pass and returns argv->items.
+// Since the unquoted tokens never take more space than the source itself the whole argv costs
+// at most two allocations. Just like with Shlex, the memory of argv is reused if you split into it again.
+char **shlex_split(const char *source, const char *source_end, ShlexArgv *argv);
+
+// Deallocates the memory of argv and zeroes it out except argv->allocator.
+void shlex_argv_free(ShlexArgv *argv);
+
+// The lines of a source split by shlex_split_lines(..).
+typedef struct {
+    // lines[i] is the NULL-terminated argv of the i-th line
+    char ***lines;
+    size_t lines_count;
+    size_t lines_capacity;
+
+    // The storages of the workers that lines point into. One per thread.
+    ShlexArgv *parts;
+    size_t parts_count;
+
+    // The allocator of everything above. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    // Must be thread-safe if more than one thread is used.
+    const ShlexAllocator *allocator;
+} ShlexLines;
+
+// Splits [source, source_end) into lines, and each line into its own argv. Unlike shlex_next_line(..) a line
+// only ends at a '\n' which is outside of the quotes and not escaped with a <backslash>, so the lines are
+// independent command lines exactly like in a shell script. The empty lines are kept as empty argvs so
+// the indices of lines stay predictable.
+//
+// If SHLEX_THREADS is defined the source is divided at the line boundaries into `threads` roughly equal
+// parts which are split in parallel with pthreads. Otherwise `threads` is ignored and everything is split on
+// the calling thread. Just like with Shlex, the memory of lines is reused if you split into it again.
+void shlex_split_lines(const char *source, const char *source_end, size_t threads, ShlexLines *lines);
+
+// Deallocates the memory of lines and zeroes it out except lines->allocator.
+void shlex_lines_free(ShlexLines *lines);
+
+// Same as shlex_split(..) but splits a single huge source on `threads` threads if SHLEX_THREADS is defined.
+// The source is cut into even chunks. First the quoting state at the beginning of each chunk is figured
+// out in parallel: each thread computes how its chunk maps every possible starting state (outside of
+// the quotes, inside of the single or double ones, right after a <backslash>) to the state at its end,
+// and chaining these maps from the beginning gives the actual starting state of each chunk.
+// Then the chunks are tokenized in parallel, and the tokens crossing their boundaries are stitched together.
+// All of the memory is allocated on the calling thread, so argv->allocator doesn't have to be thread-safe.
+char **shlex_split_parallel(const char *source, const char *source_end, size_t threads, ShlexArgv *argv);
+
+// Makes sure the string storage can fit n more bytes without reallocating. Useful to pre-size the storage
+// before a bunch of shlex_append_quoted[_sized](..) when you know roughly how long the result is going to be.
+void shlex_reserve(Shlex *s, size_t n);
+
+// Returns the counters of s if SHLEX_STATS is defined, otherwise all zeros.
+ShlexStats shlex_stats(const Shlex *s);
+
+// Shrinks the string storage down to keep bytes but never below what it currently holds. If that fits into
+// the inline buffer the heap storage is deallocated altogether. Useful to give back the memory after
+// a giant token on a long-lived shlex.
+void shlex_shrink(Shlex *s, size_t keep);
+
+// Deallocates the memory of the string storage and zeroes out the shlex except its settings:
+// s->allocator, s->track_lines, s->comments, s->punctuation, s->quoting, s->quote_cache and s->growth.
 // Generally you don't need to free the shlex like that if you plan to reuse it several times.
 // Just do shlex_init(..) or shlex_reset(..) for each input you need to process and it
 // is going to reuse the memory it allocated for the string storage every time.
 void shlex_free(Shlex *s);
 
-#endif // SHLEX_H_
+// A pool of lexers for servers which handle each request on whatever thread is free. Releasing a lexer
+// keeps its string storage for the next acquire, unless it grew past high_water bytes, so a burst of huge
+// inputs does not pin the memory forever. Thread-safe if SHLEX_THREADS is defined.
+typedef struct {
+    // The lexers ready to be acquired. They are allocated one by one, so the pointers to them stay valid.
+    Shlex **items;
+    size_t count;
+    size_t capacity;
+
+    // The string storage bigger than this is shrunk back to the inline buffer on release. 0 means no limit.
+    size_t high_water;
+
+    // The growth policy every lexer gets on acquire.
+    ShlexGrowth growth;
+
+    // The allocator of the lexers and their string storages. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    // Must be thread-safe if the pool is shared between threads.
+    const ShlexAllocator *allocator;
+
+#ifdef SHLEX_THREADS
+    pthread_mutex_t mutex;
+#endif // SHLEX_THREADS
+} ShlexPool;
+
+void shlex_pool_init(ShlexPool *pool, size_t high_water, const ShlexAllocator *allocator);
+
+// Takes a reset lexer from the pool or allocates a new one if the pool is empty.
+Shlex *shlex_pool_acquire(ShlexPool *pool);
+
+// Resets s with shlex_reset(..) and puts it back into the pool for the next shlex_pool_acquire(..).
+// Its tokens and joined strings are invalidated.
+void shlex_pool_release(ShlexPool *pool, Shlex *s);
+
+// Deallocates all of the lexers in the pool. The acquired ones must be released before that.
+void shlex_pool_free(ShlexPool *pool);
+
+// Receives each command line completed by a ShlexStream. argv is NULL-terminated like the one of shlex_split(..)
+// and is only valid until the callback returns.
+typedef void (*ShlexCommand)(void *ctx, char **argv, size_t argc);
+
+// A non-blocking driver which splits the input arriving in pieces, like over a connection, into command lines
+// ending at the unquoted newlines. It never waits for anything on its own, so it fits into any event loop:
+// pass it the bytes whenever a read completes and it calls back with every command line they complete.
+// Keep a stream per connection and drive all of them from the same thread.
+//
+// ```c
+// // epoll_wait(..) has reported that the non-blocking fd is readable
+// if (shlex_stream_read_fd(&stream, fd) != SHLEX_STREAM_AGAIN) {
+//     close(fd);
+//     shlex_stream_free(&stream);
+// }
+// ```
+//
+// With a completion based loop like io_uring, read straight into shlex_stream_buffer(..) and pass the amount of
+// the bytes read to shlex_stream_commit(..), or pass the buffers of the loop itself to shlex_stream_on_data(..).
+// Either way the lexer scans the buffer in place, only the tokens of the unfinished command line are kept in its
+// string storage, so the buffer may be reused right away. Never copy a ShlexStream by value.
+typedef struct {
+    // The lexer in the streaming mode. Set its settings, like lexer.comments, before the first piece of the input.
+    // Its errors can be checked after shlex_stream_on_eof(..).
+    Shlex lexer;
+
+    // The tokens of the current command line are collected one after another in the string storage of the lexer,
+    // and this is where each of them starts.
+    size_t *starts;
+    size_t starts_count;
+    size_t starts_capacity;
+    // The argv passed to command(..) with the room for the NULL at the end
+    char **items;
+
+    ShlexCommand command;
+    void *ctx;
+
+    // The read buffer of SHLEX_STREAM_BUFFER_SIZE bytes allocated on the first shlex_stream_buffer(..)
+    char *buffer;
+} ShlexStream;
+
+// Zeroes out the stream and sets the callback. The memory is allocated with st->lexer.allocator.
+void shlex_stream_init(ShlexStream *st, ShlexCommand command, void *ctx);
+
+// Splits the next piece of the input calling back with every command line it completes.
+void shlex_stream_on_data(ShlexStream *st, const char *data, size_t size);
+
+// Tells the stream that the input is over, so the last command line is completed even without a newline.
+void shlex_stream_on_eof(ShlexStream *st);
+
+// The read buffer of the stream and its size. Read into it and pass how many bytes came to shlex_stream_commit(..).
+char *shlex_stream_buffer(ShlexStream *st, size_t *size);
+
+// Same as shlex_stream_on_data(..) for the first size bytes of shlex_stream_buffer(..).
+void shlex_stream_commit(ShlexStream *st, size_t size);
+
+#ifndef _WIN32
+typedef enum {
+    SHLEX_STREAM_AGAIN, // Everything available has been read, wait until the fd is readable again
+    SHLEX_STREAM_EOF,   // The input is over and shlex_stream_on_eof(..) has been called
+    SHLEX_STREAM_ERROR, // read(..) has failed leaving the reason in errno
+} ShlexStreamStatus;
+
+// Reads the non-blocking fd into the read buffer of the stream until it would block, passing each read
+// to shlex_stream_commit(..). Handles EINTR. Works both with the level and the edge triggered readiness.
+ShlexStreamStatus shlex_stream_read_fd(ShlexStream *st, int fd);
+#endif // _WIN32
+
+// Drops the unfinished command line and resets the lexer with shlex_reset(..) keeping the memory for the next input,
+// like the next connection.
+void shlex_stream_reset(ShlexStream *st);
+
+// Deallocates all of the memory of the stream and zeroes it out except the settings of the lexer and the callback.
+void shlex_stream_free(ShlexStream *st);
+
+// A string stored by ShlexIntern
+typedef struct {
+    const char *data; // NULL-terminated. Never moves until shlex_intern_free(..)
+    size_t size;
+    size_t hash;
+} ShlexInterned;
+
+// A table of unique strings for the inputs which repeat the same tokens over and over, like build logs.
+// Each distinct token is stored once and gets an id, the index of it in items, so the tokens can be compared
+// by the ids and the argvs made of intern->items[id].data share the storage.
+//
+// ```c
+// ShlexIntern intern = {0};
+// size_t id;
+// shlex_init(&s, source, source_end);
+// while (shlex_next_interned(&s, &intern, &id)) {
+//     printf("%zu: %s\n", id, intern.items[id].data);
+// }
+// shlex_intern_free(&intern);
+// ```
+typedef struct {
+    ShlexInterned *items;
+    size_t count;
+    size_t capacity;
+
+    // The open addressing hash table of the ids plus one, so 0 is an empty slot. The capacity is a power of two.
+    size_t *slots;
+    size_t slots_capacity;
+
+    // The blocks the strings are stored in, the newest one first
+    struct Shlex__Intern_Block *blocks;
+
+    // The allocator of everything above. NULL means SHLEX_REALLOC(..) and SHLEX_FREE(..).
+    const ShlexAllocator *allocator;
+} ShlexIntern;
+
+// Returns the id of the string, storing it if it hasn't been seen before.
+size_t shlex_intern(ShlexIntern *intern, const char *str, size_t n);
+
+// Same as shlex_next_view(..) but interns the token and returns its id instead. The plain tokens are hashed
+// and compared right in the source, so only the unseen ones are copied and only once.
+bool shlex_next_interned(Shlex *s, ShlexIntern *intern, size_t *id);
+
+// Deallocates all of the strings and zeroes out the intern except intern->allocator.
+void shlex_intern_free(ShlexIntern *intern);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+// The C++ wrapper needs std::string_view, so it's only there since C++17.
+#if defined(__cplusplus) && __cplusplus >= 201703L
+// # The C++ wrapper
+//
+// ```cpp
+// shlex::Lexer lexer(source);
+// for (std::string_view token : lexer) {
+//     std::cout << token << "\n";
+// }
+// std::cout << shlex::join(std::vector<std::string>{"foo", "bar baz"}) << "\n";
+// ```
+#include <array>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <cstddef>
+
+namespace shlex {
+
+// Owns a Shlex and frees it on destruction. Movable but not copyable, since the string storage may live
+// inside of the Shlex itself.
+class Lexer {
+public:
+    Lexer() noexcept
+    {
+        memset(&s_, 0, sizeof(s_));
+    }
+
+    explicit Lexer(std::string_view source, const ShlexAllocator *allocator = nullptr) noexcept : Lexer()
+    {
+        s_.allocator = allocator;
+        reset(source);
+    }
+
+    ~Lexer()
+    {
+        shlex_free(&s_);
+    }
+
+    Lexer(const Lexer&) = delete;
+    Lexer &operator=(const Lexer&) = delete;
+
+    Lexer(Lexer &&other) noexcept : Lexer()
+    {
+        take(other);
+    }
+
+    Lexer &operator=(Lexer &&other) noexcept
+    {
+        if (this != &other) {
+            shlex_free(&s_);
+            take(other);
+        }
+        return *this;
+    }
+
+    // Starts splitting a new source reusing the memory of the string storage.
+    void reset(std::string_view source) noexcept
+    {
+        shlex_init(&s_, source.data(), source.data() + source.size());
+    }
+
+    // The next token as a view into the source if it's pure or into the string storage otherwise.
+    // Either way it's valid until the next call. Returns false when ran out of tokens.
+    bool next(std::string_view &token) noexcept
+    {
+        const char *ptr;
+        size_t len;
+        if (!shlex_next_view(&s_, &ptr, &len)) return false;
+        token = std::string_view(ptr, len);
+        return true;
+    }
+
+    // Quotes everything in the range of things convertible to std::string_view into a single command line.
+    // The view points into the string storage and is valid until the next use of the lexer. The range is
+    // iterated twice, first to size the storage upfront, so it must be a multi-pass (forward) range.
+    template <typename Range>
+    std::string_view join(const Range &args)
+    {
+        shlex_reset(&s_);
+        size_t n = 1; // NULL-terminator
+        bool first = true;
+        for (const auto &arg : args) {
+            std::string_view view(arg);
+            if (!first) n += 1; // Separator
+            n += shlex_quoted_len_with(view.data(), view.size(), s_.quoting);
+            first = false;
+        }
+        shlex_reserve(&s_, n);
+        for (const auto &arg : args) {
+            std::string_view view(arg);
+            shlex_append_quoted_sized(&s_, view.data(), view.size());
+        }
+        // Whatever was actually appended, even if the second pass did not see the same arguments
+        size_t joined_len = s_.string_count;
+        const char *joined = shlex_join(&s_);
+        return std::string_view(joined, joined_len);
+    }
+
+    // A single pass over the tokens of the lexer. Advancing it invalidates the previous token.
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        iterator() noexcept = default;
+        explicit iterator(Lexer *lexer) noexcept : lexer_(lexer)
+        {
+            ++*this;
+        }
+
+        reference operator*() const noexcept { return token_; }
+        pointer operator->() const noexcept { return &token_; }
+
+        iterator &operator++() noexcept
+        {
+            if (!lexer_->next(token_)) lexer_ = nullptr;
+            return *this;
+        }
+
+        // Keeps a copy of the previous token for *it++, since advancing may overwrite the string storage it points into.
+        class postfix_proxy {
+        public:
+            explicit postfix_proxy(std::string_view token) : token_(token) {}
+            std::string_view operator*() const noexcept { return token_; }
+
+        private:
+            std::string token_;
+        };
+
+        postfix_proxy operator++(int)
+        {
+            postfix_proxy old(token_);
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const noexcept { return lexer_ == other.lexer_; }
+        bool operator!=(const iterator &other) const noexcept { return lexer_ != other.lexer_; }
+
+    private:
+        Lexer *lexer_ = nullptr;
+        std::string_view token_;
+    };
+
+    iterator begin() noexcept { return iterator(this); }
+    iterator end() noexcept { return iterator(); }
+
+    // For everything the wrapper doesn't cover, like streaming, positions and errors.
+    Shlex *get() noexcept { return &s_; }
+    const Shlex *get() const noexcept { return &s_; }
+
+private:
+    // Steals the string storage of other leaving it empty but with the same allocator.
+    void take(Lexer &other) noexcept
+    {
+        memcpy(&s_, &other.s_, sizeof(s_));
+        if (other.s_.string == other.s_.inline_string) s_.string = s_.inline_string;
+        memset(&other.s_, 0, sizeof(other.s_));
+        other.s_.allocator = s_.allocator;
+    }
+
+    Shlex s_;
+};
+
+// Same as Lexer::join(..) but returns an owned string.
+template <typename Range>
+std::string join(const Range &args)
+{
+    Lexer lexer;
+    return std::string(lexer.join(args));
+}
+
+// # Compile-time splitting and quoting
+//
+// The command lines known at build time can be split and quoted by the compiler:
+//
+// ```cpp
+// static constexpr auto git = shlex::static_split("git rev-parse --short HEAD");
+// static constexpr auto path = shlex::static_quote("my file.txt");
+// ```
+//
+// The rules are the same as of shlex_next(..) and shlex_append_quoted_sized(..), just reimplemented with
+// constexpr since the C implementation can't run at compile time.
+
+namespace detail {
+
+constexpr bool is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Mirrors SHLEX__CC_SAFE of shlex__char_class
+constexpr bool is_safe(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '%' || c == '+' || c == ',' || c == '-' || c == '.' || c == '/' ||
+           c == ':' || c == '=' || c == '@' || c == '_';
+}
+
+// The length of a string literal not counting its NULL-terminator
+template <std::size_t N>
+constexpr std::size_t literal_len(const char (&str)[N])
+{
+    return N > 0 && str[N - 1] == '\0' ? N - 1 : N;
+}
+
+} // namespace detail
+
+// The tokens of a string literal of size N split at compile time. The unquoted tokens are stored NULL-terminated
+// one after another in data, just like ShlexArgv does, which never takes more than the source plus one byte.
+template <std::size_t N>
+struct StaticArgv {
+    char data[N + 1] = {};
+    std::size_t starts[N/2 + 1] = {};
+    std::size_t lens[N/2 + 1] = {};
+    std::size_t count = 0;
+
+    constexpr std::size_t size() const { return count; }
+    constexpr std::string_view operator[](std::size_t i) const { return std::string_view(data + starts[i], lens[i]); }
+    constexpr const char *c_str(std::size_t i) const { return data + starts[i]; }
+
+    // All of the tokens as views into data. Only the first count of them are meaningful.
+    constexpr std::array<std::string_view, N/2 + 1> views() const
+    {
+        std::array<std::string_view, N/2 + 1> result = {};
+        for (std::size_t i = 0; i < count; ++i) result[i] = (*this)[i];
+        return result;
+    }
+};
+
+template <std::size_t N>
+constexpr StaticArgv<N> static_split(const char (&source)[N])
+{
+    StaticArgv<N> argv;
+    std::size_t len = detail::literal_len(source);
+    std::size_t i = 0;
+    std::size_t d = 0;
+    for (;;) {
+        while (i < len && detail::is_space(source[i])) i++;
+        if (i >= len) break;
+
+        std::size_t start = d;
+        char strlit = 0;
+        bool escaped = false;
+        while (i < len) {
+            char c = source[i];
+            if (strlit == '\'') {
+                if (c == '\'') strlit = 0; else argv.data[d++] = c;
+                i++;
+            } else if (c == '\\') {
+                i++;
+                if (i >= len) {
+                    escaped = true;
+                    break;
+                }
+                c = source[i++];
+                bool special = c == '$' || c == '`' || c == '\\' || c == '\n' || c == '"';
+                if (strlit == '"' && !special) argv.data[d++] = '\\';
+                argv.data[d++] = c;
+            } else if (strlit == '"') {
+                if (c == '"') strlit = 0; else argv.data[d++] = c;
+                i++;
+            } else if (detail::is_space(c)) {
+                break;
+            } else {
+                if (c == '\'' || c == '"') strlit = c; else argv.data[d++] = c;
+                i++;
+            }
+        }
+        // Same recovery from the unfinished escape sequence as in shlex__next_token(..)
+        if (escaped && strlit == '"') argv.data[d++] = '\\';
+
+        argv.starts[argv.count] = start;
+        argv.lens[argv.count] = d - start;
+        argv.count += 1;
+        argv.data[d++] = '\0';
+    }
+    return argv;
+}
+
+// The quoted form of a string literal of size N. Every single-quote may turn into 5 bytes plus the surrounding ones.
+template <std::size_t N>
+struct StaticQuoted {
+    char data[5*N + 3] = {};
+    std::size_t size = 0;
+
+    constexpr std::string_view view() const { return std::string_view(data, size); }
+    constexpr const char *c_str() const { return data; }
+};
+
+template <std::size_t N>
+constexpr StaticQuoted<N> static_quote(const char (&arg)[N])
+{
+    StaticQuoted<N> quoted;
+    std::size_t len = detail::literal_len(arg);
+    bool safe = len > 0;
+    for (std::size_t i = 0; i < len; ++i) {
+        if (!detail::is_safe(arg[i])) safe = false;
+    }
+    if (safe) {
+        for (std::size_t i = 0; i < len; ++i) quoted.data[quoted.size++] = arg[i];
+        return quoted;
+    }
+
+    quoted.data[quoted.size++] = '\'';
+    for (std::size_t i = 0; i < len; ++i) {
+        if (arg[i] == '\'') {
+            const char escape[] = "'\"'\"'";
+            for (std::size_t j = 0; j < 5; ++j) quoted.data[quoted.size++] = escape[j];
+        } else {
+            quoted.data[quoted.size++] = arg[i];
+        }
+    }
+    quoted.data[quoted.size++] = '\'';
+    return quoted;
+}
+
+} // namespace shlex
+#endif // __cplusplus >= 201703L
+
+#endif // SHLEX_H_
+
+#ifdef SHLEX_IMPLEMENTATION
+
+#ifndef SHLEX_REALLOC
+#define SHLEX_REALLOC realloc
+#endif // SHLEX_REALLOC
+
+#ifndef SHLEX_FREE
+#define SHLEX_FREE free
+#endif // SHLEX_FREE
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#    include <sys/uio.h>
+#endif // _WIN32
+
+#if !defined(SHLEX_NO_SIMD) && defined(__AVX2__)
+#    include <immintrin.h>
+#    define SHLEX__AVX2
+#    define SHLEX__SSSE3
+#    define SHLEX__SSE2
+#elif !defined(SHLEX_NO_SIMD) && defined(__SSE2__)
+#    include <emmintrin.h>
+#    define SHLEX__SSE2
+#    ifdef __SSSE3__
+#        include <tmmintrin.h>
+#        define SHLEX__SSSE3
+#    endif // __SSSE3__
+#elif !defined(SHLEX_NO_SIMD) && defined(__ARM_NEON)
+#    include <arm_neon.h>
+#    define SHLEX__NEON
+#    ifdef __aarch64__
+#        define SHLEX__NEON_TBL
+#    endif // __aarch64__
+#endif
+
+// The character classes of shlex__char_class.
+#define SHLEX__CC_SPACE  0x01 // Whitespace as in isspace(..) of the "C" locale
+#define SHLEX__CC_SAFE   0x02 // Doesn't need quoting in shlex_append_quoted[_sized](..)
+#define SHLEX__CC_QUOTE  0x04 // Starts a string literal
+#define SHLEX__CC_ESCAPE 0x08 // <backslash>
+#define SHLEX__CC_COMMENT 0x10 // Starts a comment when Shlex.comments is on
+#define SHLEX__CC_PUNCT  0x20 // Punctuation when Shlex.punctuation is on
+
+// The character classification table indexed by unsigned char. It does not depend on the locale,
+// unlike isspace(..) and isalnum(..). Everything above 0x7F is left zero.
+#define SHLEX__W SHLEX__CC_SPACE
+#define SHLEX__A SHLEX__CC_SAFE
+#define SHLEX__Q SHLEX__CC_QUOTE
+#define SHLEX__E SHLEX__CC_ESCAPE
+#define SHLEX__C SHLEX__CC_COMMENT
+#define SHLEX__P SHLEX__CC_PUNCT
+static const unsigned char shlex__char_class[256] = {
+           0,        0,        0,        0,        0,        0,        0,        0, // 0x00
+           0, SHLEX__W, SHLEX__W, SHLEX__W, SHLEX__W, SHLEX__W,        0,        0, // 0x08
+           0,        0,        0,        0,        0,        0,        0,        0, // 0x10
+           0,        0,        0,        0,        0,        0,        0,        0, // 0x18
+    SHLEX__W,        0, SHLEX__Q, SHLEX__C,        0, SHLEX__A, SHLEX__P, SHLEX__Q, // 0x20
+    SHLEX__P, SHLEX__P,        0, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x28
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x30
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__P, SHLEX__P, SHLEX__A, SHLEX__P,        0, // 0x38
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x40
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x48
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x50
+    SHLEX__A, SHLEX__A, SHLEX__A,        0, SHLEX__E,        0,        0, SHLEX__A, // 0x58
+           0, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x60
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x68
+    SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, SHLEX__A, // 0x70
+    SHLEX__A, SHLEX__A, SHLEX__A,        0, SHLEX__P,        0,        0,        0, // 0x78
+};
+#undef SHLEX__W
+#undef SHLEX__A
+#undef SHLEX__Q
+#undef SHLEX__E
+#undef SHLEX__C
+#undef SHLEX__P
+
+static inline bool shlex__is(char c, unsigned char cc)
+{
+    return (shlex__char_class[(unsigned char)c] & cc) != 0;
+}
+
+static char *shlex__next_token(Shlex *s);
+static void *shlex__realloc(const ShlexAllocator *allocator, void *ptr, size_t old_size, size_t new_size);
+static void shlex__free(const ShlexAllocator *allocator, void *ptr, size_t size);
+static void shlex__string_reserve(Shlex *s, size_t n);
+static void shlex__string_resize(Shlex *s, size_t string_capacity);
+static void shlex__argv_push(ShlexArgv *argv, char *item);
+static size_t shlex__split_into(ShlexArgv *argv, size_t data_count, const char *source, const char *source_end);
+static const char *shlex__find_line_end(const char *p, const char *end);
+static const char *shlex__find_structural(const char *p, const char *end);
+static void shlex__scan_states(const char *begin, const char *end, int *end_state, bool *end_in_token);
+static void shlex__string_append(Shlex *s, char x);
+static void shlex__string_append_sized(Shlex *s, const char *str, size_t n);
+static void shlex__append_quoted(Shlex *s, const char *str, size_t n);
+static void shlex__append_unsafe(Shlex *s, const char *str, const char *unsafe, const char *end);
+static void shlex__append_cached(Shlex *s, const char *str, const char *unsafe, const char *end);
+static const char *shlex__find_unsafe(const char *p, const char *end);
+static const char *shlex__find_special(const char *p, const char *end);
+static const char *shlex__skip_token(const char *p, const char *end, bool *needs_unescape, ShlexError *error, const char **error_point);
+static size_t shlex__hash(const char *str, size_t n);
+
+void shlex_init(Shlex *s, const char *source, const char *source_end)
+{
+    shlex_reset(s);
+    s->source = source;
+    s->source_end = source_end;
+    s->point = source;
+    s->line_point = source;
+}
+
+void shlex_free(Shlex *s)
+{
+    const ShlexAllocator *allocator = s->allocator;
+    bool track_lines = s->track_lines;
+    bool comments = s->comments;
+    bool punctuation = s->punctuation;
+    ShlexQuoting quoting = s->quoting;
+    ShlexQuoteCache *quote_cache = s->quote_cache;
+    ShlexGrowth growth = s->growth;
+    if (s->string != s->inline_string) shlex__free(allocator, s->string, s->string_capacity);
+    memset(s, 0, sizeof(*s));
+    s->allocator = allocator;
+    s->track_lines = track_lines;
+    s->comments = comments;
+    s->punctuation = punctuation;
+    s->quoting = quoting;
+    s->quote_cache = quote_cache;
+    s->growth = growth;
+}
+
+// Counts the newlines between s->line_point and p which must be within the current source.
+static void shlex__count_lines(Shlex *s, const char *p)
+{
+    while (s->line_point < p) {
+        const char *newline = (const char*)memchr(s->line_point, '\n', p - s->line_point);
+        if (newline == NULL) break;
+        s->line_count += 1;
+        s->line_start = s->source_offset + (newline + 1 - s->source);
+        s->line_point = newline + 1;
+    }
+    s->line_point = p;
+}
+
+// Remembers that a token starts at s->point
+static void shlex__token_start(Shlex *s)
+{
+    s->token_start = s->source_offset + (s->point - s->source);
+    if (s->track_lines) {
+        shlex__count_lines(s, s->point);
+        s->token_line = s->line_count + 1;
+        s->token_column = s->token_start - s->line_start + 1;
+    }
+}
+
+static void shlex__skip_whitespace(Shlex *s)
+{
+    while (s->point < s->source_end && shlex__is(*s->point, SHLEX__CC_SPACE)) {
+        s->point++;
+    }
+}
+
+// Skips the whitespace between the tokens and also the comments when s->comments is on
+static void shlex__skip_blank(Shlex *s)
+{
+    for (;;) {
+        if (s->in_comment) {
+            const char *newline = (const char*)memchr(s->point, '\n', s->source_end - s->point);
+            if (newline == NULL) {
+                // The comment may go on in the next chunk
+                s->point = s->source_end;
+                return;
+            }
+            s->point = newline;
+            s->in_comment = false;
+        }
+        shlex__skip_whitespace(s);
+        if (!s->comments || s->point >= s->source_end || *s->point != '#') return;
+        s->in_comment = true;
+    }
+}
+
+// Finds where the run of the characters that don't mean anything to the lexer outside of the quotes ends
+static const char *shlex__find_word_end(const Shlex *s, const char *p, const char *end)
+{
+    if (!s->comments && !s->punctuation) return shlex__find_special(p, end);
+
+    // The SIMD kernel only knows the default set of the special characters, so we just look up the table
+    unsigned char mask = SHLEX__CC_SPACE | SHLEX__CC_QUOTE | SHLEX__CC_ESCAPE;
+    if (s->comments) mask |= SHLEX__CC_COMMENT;
+    if (s->punctuation) mask |= SHLEX__CC_PUNCT;
+    while (p < end && !shlex__is(*p, mask)) p++;
+    return p;
+}
+
+static const char *shlex__find_punct_end(const char *p, const char *end)
+{
+    while (p < end && shlex__is(*p, SHLEX__CC_PUNCT)) p++;
+    return p;
+}
+
+static char *shlex__next(Shlex *s)
+{
+    if (!s->in_token) {
+        shlex__skip_blank(s);
+        if (s->point >= s->source_end) return NULL;
+        shlex__token_start(s);
+        s->string_count = 0;
+        s->in_token = true;
+        s->in_punct = s->punctuation && shlex__is(*s->point, SHLEX__CC_PUNCT);
+    }
+    if (shlex__next_token(s) == NULL) return NULL;
+    s->token_end = s->source_offset + (s->point - s->source);
+    return s->string;
+}
+
+static bool shlex__next_view(Shlex *s, const char **ptr, size_t *len)
+{
+    if (!s->in_token) {
+        shlex__skip_blank(s);
+        if (s->point >= s->source_end) return false;
+        shlex__token_start(s);
+
+        const char *start = s->point;
+        const char *special;
+        bool plain;
+        bool more_input = s->streaming && !s->finished;
+        s->in_punct = s->punctuation && shlex__is(*start, SHLEX__CC_PUNCT);
+        if (s->in_punct) {
+            special = shlex__find_punct_end(start, s->source_end);
+            plain = special < s->source_end || !more_input;
+        } else {
+            special = shlex__find_word_end(s, start, s->source_end);
+            plain = special < s->source_end ? !shlex__is(*special, SHLEX__CC_QUOTE | SHLEX__CC_ESCAPE) : !more_input;
+        }
+        if (plain) {
+            // The token ended before anything that requires unquoting
+            s->in_punct = false;
+            s->point = special;
+            s->token_end = s->source_offset + (special - s->source);
+            *ptr = start;
+            *len = special - start;
+            return true;
+        }
+
+        // Picking up where the scan has stopped so the plain prefix is not scanned twice
+        s->string_count = 0;
+        s->in_token = true;
+        shlex__string_append_sized(s, start, special - start);
+        s->point = special;
+    }
+
+    if (shlex__next_token(s) == NULL) return false;
+    s->token_end = s->source_offset + (s->point - s->source);
+    *ptr = s->string;
+    *len = s->string_count - 1;
+    return true;
+}
+
+#ifdef SHLEX_STATS
+// Accounts a call to a lexing function that started at point and found a token of len bytes if found is true
+static void shlex__stats_next(Shlex *s, const char *point, bool found, size_t len)
+{
+    s->stats.bytes_scanned += s->point - point;
+    if (found) {
+        s->stats.tokens += 1;
+        // Unquoting always removes something from the token
+        if (s->token_end - s->token_start != len) s->stats.unescaped_tokens += 1;
+    }
+}
+#endif // SHLEX_STATS
+
+char *shlex_next(Shlex *s)
+{
+#ifdef SHLEX_STATS
+    const char *point = s->point;
+    char *token = shlex__next(s);
+    shlex__stats_next(s, point, token != NULL, token != NULL ? s->string_count - 1 : 0);
+    return token;
+#else
+    return shlex__next(s);
+#endif // SHLEX_STATS
+}
+
+bool shlex_next_view(Shlex *s, const char **ptr, size_t *len)
+{
+#ifdef SHLEX_STATS
+    const char *point = s->point;
+    bool found = shlex__next_view(s, ptr, len);
+    shlex__stats_next(s, point, found, found ? *len : 0);
+    return found;
+#else
+    return shlex__next_view(s, ptr, len);
+#endif // SHLEX_STATS
+}
+
+ShlexStats shlex_stats(const Shlex *s)
+{
+#ifdef SHLEX_STATS
+    return s->stats;
+#else
+    ShlexStats stats;
+    (void) s;
+    memset(&stats, 0, sizeof(stats));
+    return stats;
+#endif // SHLEX_STATS
+}
+
+void shlex_feed(Shlex *s, const char *chunk, size_t len)
+{
+    // The previous chunk is done with, so its newlines have to be counted before it goes away
+    if (s->track_lines) shlex__count_lines(s, s->source_end);
+    s->source_offset += s->source_end - s->source;
+    s->line_point = chunk;
+    s->source = chunk;
+    s->source_end = chunk + len;
+    s->point = chunk;
+    s->streaming = true;
+}
+
+void shlex_finish(Shlex *s)
+{
+    s->finished = true;
+}
+
+size_t shlex_index(Shlex *s, ShlexIndexEntry *entries, size_t capacity)
+{
+    assert(!s->streaming && !s->in_token && !s->comments && !s->punctuation);
+#ifdef SHLEX_STATS
+    const char *point = s->point;
+#endif // SHLEX_STATS
+    size_t count = 0;
+    while (count < capacity) {
+        shlex__skip_whitespace(s);
+        if (s->point >= s->source_end) break;
+        ShlexIndexEntry *entry = &entries[count++];
+        entry->start = s->point - s->source;
+        ShlexError error = SHLEX_OK;
+        const char *error_point = NULL;
+        s->point = shlex__skip_token(s->point, s->source_end, &entry->needs_unescape, &error, &error_point);
+        entry->end = s->point - s->source;
+        // Only the first error is kept, just like shlex_next(..) does
+        if (error != SHLEX_OK && s->error == SHLEX_OK) {
+            s->error = error;
+            s->error_offset = s->source_offset + (error_point - s->source);
+        }
+#ifdef SHLEX_STATS
+        s->stats.unescaped_tokens += entry->needs_unescape;
+#endif // SHLEX_STATS
+    }
+#ifdef SHLEX_STATS
+    s->stats.bytes_scanned += s->point - point;
+    s->stats.tokens += count;
+#endif // SHLEX_STATS
+    return count;
+}
+
+char *shlex_decode(Shlex *s, const ShlexIndexEntry *entry)
+{
+    // Not copying the whole Shlex, since the string storage may be inside of it
+    const char *source_end = s->source_end;
+    const char *point = s->point;
+    char strlit = s->strlit;
+    bool escaped = s->escaped;
+    bool in_token = s->in_token;
+    bool streaming = s->streaming;
+    size_t strlit_start = s->strlit_start;
+    ShlexError error = s->error;
+    size_t error_offset = s->error_offset;
+
+    s->point = s->source + entry->start;
+    s->source_end = s->source + entry->end;
+    s->strlit = 0;
+    s->escaped = false;
+    s->in_token = true;
+    s->streaming = false;
+    s->string_count = 0;
+    shlex__next_token(s);
+
+    // Everything but the string storage goes back to how it was
+    s->source_end = source_end;
+    s->point = point;
+    s->strlit = strlit;
+    s->escaped = escaped;
+    s->in_token = in_token;
+    s->streaming = streaming;
+    s->strlit_start = strlit_start;
+    s->error = error;
+    s->error_offset = error_offset;
+    s->token_start = entry->start;
+    s->token_end = entry->end;
+    return s->string;
+}
+
+// Appends the character at s->point escaped by the preceding <backslash> according to the current quotes.
+static void shlex__append_escaped(Shlex *s)
+{
+    if (s->strlit == '"') {
+        switch (*s->point) {
+        // POSIX.1-2024 - 2.2.3 Double-Quotes
+        // > <backslash> shall retain its special meaning as an escape character (see 2.2.1 Escape Character (Backslash)) only when immediately followed by one of the following characters $   `   \   <newline> or by a double-quote character that would otherwise be considered special
+        case '$':
+        case '`':
+        case '\\':
+        case '\n':
+        case '"':
+            shlex__string_append(s, *s->point);
+            break;
+        default: {
+            char escape[2] = {'\\', *s->point};
+            shlex__string_append_sized(s, escape, sizeof(escape));
+        }
+        }
+    } else {
+        // POSIX.1-2024 - 2.2.1 Escape Character (Backslash)
+        // > A <backslash> that is not quoted shall preserve the literal value of the following character, ...
+        shlex__string_append(s, *s->point);
+    }
+    s->point++;
+}
+
+// Continues the token started at s->point appending it to the string storage with NULL-terminator.
+// Returns NULL if the chunk ran out before the end of the token in the streaming mode.
+static char *shlex__next_token(Shlex *s)
+{
+    // The run of punctuation can't contain quotes or <backslash>es, it just ends at anything else
+    if (s->in_punct) {
+        const char *punct_end = shlex__find_punct_end(s->point, s->source_end);
+        shlex__string_append_sized(s, s->point, punct_end - s->point);
+        s->point = punct_end;
+        if (s->point >= s->source_end && s->streaming && !s->finished) return NULL;
+        shlex__string_append(s, '\0');
+        s->in_punct = false;
+        s->in_token = false;
+        return s->string;
+    }
+
+    if (s->escaped && s->point < s->source_end) {
+        s->escaped = false;
+        shlex__append_escaped(s);
+    }
+
+    while (s->point < s->source_end) {
+        switch (s->strlit) {
+        // POSIX.1-2024 - 2.2.2 Single-Quotes
+        // > Enclosing characters in single-quotes ('') shall preserve the literal value of each character within the single-quotes. A single-quote cannot occur within single-quotes.
+        case '\'': {
+            // The only special character inside of the single-quotes is the closing single-quote,
+            // so we can just copy everything up to it in one go.
+            const char *quote = (const char*)memchr(s->point, '\'', s->source_end - s->point);
+            if (quote == NULL) quote = s->source_end;
+            shlex__string_append_sized(s, s->point, quote - s->point);
+            s->point = quote;
+            if (s->point < s->source_end) {
+                s->strlit = 0;
+                s->point++;
+            }
+        } break;
+        // POSIX.1-2024 - 2.2.3 Double-Quotes
+        // > Enclosing characters in double-quotes ("") shall preserve the literal value of all characters within the double-quotes, with the exception of the characters backquote, <dollar-sign>, and <backslash> ...
+        // We only care about <backslash> since <dollar-sign> and backquote is related to semantics of the Shell language. We do a pure lexical analysis.
+        case '"':
+            switch (*s->point) {
+            case '"':
+                s->strlit = 0;
+                s->point++;
+                break;
+            case '\\':
+                s->point++;
+                if (s->point < s->source_end) {
+                    shlex__append_escaped(s);
+                } else {
+                    s->escaped = true;
+                }
+                break;
+            default: {
+                const char *special = s->point + 1;
+                while (special < s->source_end && *special != '"' && *special != '\\') special++;
+                shlex__string_append_sized(s, s->point, special - s->point);
+                s->point = special;
+            }
+            }
+            break;
+        case '\0': {
+            // Copying the run of the characters that don't mean anything to the lexer in one go.
+            const char *special = shlex__find_word_end(s, s->point, s->source_end);
+            shlex__string_append_sized(s, s->point, special - s->point);
+            s->point = special;
+            if (s->point >= s->source_end) break;
+
+            switch (*s->point) {
+            case '"':
+            case '\'':
+                s->strlit = *s->point;
+                s->strlit_start = s->source_offset + (s->point - s->source);
+                s->point++;
+                break;
+            case '\\':
+                s->point++;
+                if (s->point < s->source_end) {
+                    shlex__append_escaped(s);
+                } else {
+                    s->escaped = true;
+                }
+                break;
+            // Otherwise it's the whitespace or the start of a comment or punctuation, which are left for the next token
+            default:
+                shlex__string_append(s, '\0');
+                s->in_token = false;
+                return s->string;
+            }
+        } break;
+        default:
+            assert(0 && "UNREACHABLE");
+        }
+    }
+
+    // The next chunk may continue the token
+    if (s->streaming && !s->finished) return NULL;
+
+    if (s->error == SHLEX_OK) {
+        if (s->strlit != 0) {
+            s->error = s->strlit == '\'' ? SHLEX_ERROR_UNTERMINATED_SINGLE_QUOTE : SHLEX_ERROR_UNTERMINATED_DOUBLE_QUOTE;
+            s->error_offset = s->strlit_start;
+        } else if (s->escaped) {
+            s->error = SHLEX_ERROR_TRAILING_BACKSLASH;
+            s->error_offset = s->source_offset + (s->source_end - s->source) - 1;
+        }
+    }
+
+    // We don't really know what to do with unfinished escape sequences in the context of shlex, so in
+    // double-quotes we just interpret the <backslash> literally and outside of them we drop it.
+    if (s->escaped && s->strlit == '"') shlex__string_append(s, '\\');
+    shlex__string_append(s, '\0');
+    s->strlit = 0;
+    s->escaped = false;
+    s->in_token = false;
+    return s->string;
+}
+
+void shlex_reset(Shlex *s)
+{
+    s->source = NULL;
+    s->source_end = NULL;
+    s->point = NULL;
+    s->strlit = 0;
+    s->escaped = false;
+    s->in_token = false;
+    s->streaming = false;
+    s->finished = false;
+    s->strlit_start = 0;
+    s->in_comment = false;
+    s->in_punct = false;
+    s->error = SHLEX_OK;
+    s->error_offset = 0;
+    s->token_start = 0;
+    s->token_end = 0;
+    s->source_offset = 0;
+    s->token_line = 0;
+    s->token_column = 0;
+    s->line_point = NULL;
+    s->line_count = 0;
+    s->line_start = 0;
+    s->string_count = 0;
+    // Important! Do not touch s->string_capacity and s->string! They are important for reusage of the allocated memory.
+    // Unless they grew past what the growth policy allows to keep around.
+    if (s->growth.trim_above > 0 && s->string_capacity > s->growth.trim_above) shlex_shrink(s, 0);
+}
+
+void shlex_append_quoted(Shlex *s, const char *cstr)
+{
+    shlex_append_quoted_sized(s, cstr, strlen(cstr));
+}
+
+// What the minimal quoting needs to know about an argument to pick its shortest encoding.
+typedef struct {
+    size_t unsafe;          // The characters that need quoting with SHLEX__CC_SAFE
+    size_t single_quotes;   // Cost 4 more bytes each in single-quotes
+    size_t double_specials; // \\ $ ` " need a <backslash> in double-quotes
+    bool unbackslashable;   // <backslash><newline> is a line continuation and the non-ASCII bytes may be a part
+                            // of a multibyte character, so they can't be escaped with a <backslash> one by one
+} Shlex__Quote_Counts;
+
+typedef enum {
+    SHLEX__ENCODING_SINGLE,
+    SHLEX__ENCODING_DOUBLE,
+    SHLEX__ENCODING_BACKSLASH,
+} Shlex__Encoding;
+
+// Counts everything in a single pass over [p, end) where p is the first unsafe character of the argument.
+static Shlex__Quote_Counts shlex__count_quotes(const char *p, const char *end)
+{
+    Shlex__Quote_Counts counts;
+    memset(&counts, 0, sizeof(counts));
+    for (; p < end; ++p) {
+        if (shlex__is(*p, SHLEX__CC_SAFE)) continue;
+        counts.unsafe += 1;
+        switch (*p) {
+        case '\'':
+            counts.single_quotes += 1;
+            break;
+        case '\\':
+        case '$':
+        case '`':
+        case '"':
+            counts.double_specials += 1;
+            break;
+        case '\n':
+            counts.unbackslashable = true;
+            break;
+        default:
+            if ((unsigned char)*p >= 0x80) counts.unbackslashable = true;
+        }
+    }
+    return counts;
+}
+
+// Picks the shortest encoding of the argument of n bytes preferring the single-quotes on ties since they are
+// the easiest to read. Optionally returns the length of the encoded argument.
+static Shlex__Encoding shlex__pick_encoding(const Shlex__Quote_Counts *counts, size_t n, size_t *len)
+{
+    Shlex__Encoding encoding = SHLEX__ENCODING_SINGLE;
+    size_t best = n + 2 + counts->single_quotes*4;
+    if (n + 2 + counts->double_specials < best) {
+        encoding = SHLEX__ENCODING_DOUBLE;
+        best = n + 2 + counts->double_specials;
+    }
+    if (!counts->unbackslashable && n + counts->unsafe < best) {
+        encoding = SHLEX__ENCODING_BACKSLASH;
+        best = n + counts->unsafe;
+    }
+    if (len) *len = best;
+    return encoding;
+}
+
+// Appends [str, end) in double-quotes where unsafe is the first unsafe character.
+static void shlex__append_double_quoted(Shlex *s, const char *str, const char *unsafe, const char *end)
+{
+    shlex__string_append(s, '"');
+    shlex__string_append_sized(s, str, unsafe - str);
+    str = unsafe;
+    while (str < end) {
+        const char *special = str;
+        while (special < end && *special != '\\' && *special != '$' && *special != '`' && *special != '"') special++;
+        shlex__string_append_sized(s, str, special - str);
+        if (special < end) {
+            char escape[2] = {'\\', *special};
+            shlex__string_append_sized(s, escape, sizeof(escape));
+            special++;
+        }
+        str = special;
+    }
+    shlex__string_append(s, '"');
+}
+
+// Appends [str, end) with a <backslash> before each unsafe character where unsafe is the first of them.
+static void shlex__append_backslashed(Shlex *s, const char *str, const char *unsafe, const char *end)
+{
+    while (str < end) {
+        shlex__string_append_sized(s, str, unsafe - str);
+        if (unsafe < end) {
+            char escape[2] = {'\\', *unsafe};
+            shlex__string_append_sized(s, escape, sizeof(escape));
+            unsafe++;
+        }
+        str = unsafe;
+        while (unsafe < end && shlex__is(*unsafe, SHLEX__CC_SAFE)) unsafe++;
+    }
+}
+
+void shlex_append_quoted_sized(Shlex *s, const char *str, size_t n)
+{
+    // The separator and the bytes themselves are needed anyway. Not reserving more here keeps the exact
+    // size computed by shlex_join_argv(..) sufficient even for the last unquoted argument.
+    shlex__string_reserve(s, n + 1);
+
+    if (s->string_count > 0) shlex__string_append(s, ' ');
+    shlex__append_quoted(s, str, n);
+}
+
+// Appends the quoted argument without the separator.
+static void shlex__append_quoted(Shlex *s, const char *str, size_t n)
+{
+    if (n == 0) {
+#ifdef SHLEX_STATS
+        s->stats.quoted_args += 1;
+#endif // SHLEX_STATS
+        shlex__string_append_sized(s, "''", 2);
+        return;
+    }
+
+    // Scanning for the unsafe characters and copying happen in the same pass: whatever precedes
+    // the first unsafe character is copied as is, and it can't contain any single-quotes either.
+    const char *end = str + n;
+    const char *unsafe = shlex__find_unsafe(str, end);
+    if (unsafe >= end) {
+#ifdef SHLEX_STATS
+        s->stats.bare_args += 1;
+#endif // SHLEX_STATS
+        shlex__string_append_sized(s, str, n);
+        return;
+    }
+#ifdef SHLEX_STATS
+    s->stats.quoted_args += 1;
+#endif // SHLEX_STATS
+
+    if (s->quote_cache != NULL && n <= SHLEX_QUOTE_CACHE_MAX_SIZE) {
+        shlex__append_cached(s, str, unsafe, end);
+    } else {
+        shlex__append_unsafe(s, str, unsafe, end);
+    }
+}
+
+// Quotes the argument [str, end) whose first character that needs quoting is unsafe.
+static void shlex__append_unsafe(Shlex *s, const char *str, const char *unsafe, const char *end)
+{
+    size_t n = end - str;
+    if (s->quoting == SHLEX_QUOTE_MINIMAL) {
+        Shlex__Quote_Counts counts = shlex__count_quotes(unsafe, end);
+        switch (shlex__pick_encoding(&counts, n, NULL)) {
+        case SHLEX__ENCODING_DOUBLE:
+            shlex__append_double_quoted(s, str, unsafe, end);
+            return;
+        case SHLEX__ENCODING_BACKSLASH:
+            shlex__append_backslashed(s, str, unsafe, end);
+            return;
+        case SHLEX__ENCODING_SINGLE:
+            break;
+        }
+    }
+
+    shlex__string_append(s, '\'');
+    shlex__string_append_sized(s, str, unsafe - str);
+    str = unsafe;
+    while (str < end) {
+        const char *quote = (const char*)memchr(str, '\'', end - str);
+        if (quote == NULL) quote = end;
+        shlex__string_append_sized(s, str, quote - str);
+        if (quote < end) {
+            shlex__string_append_sized(s, "'\"'\"'", 5);
+            quote++;
+        }
+        str = quote;
+    }
+    shlex__string_append(s, '\'');
+}
+
+// Same as shlex__append_unsafe(..) but takes the quoted form from s->quote_cache if it's there and puts it there
+// otherwise. The quoted form is the same either way, so the sizes computed by shlex_quoted_len_with(..) hold.
+static void shlex__append_cached(Shlex *s, const char *str, const char *unsafe, const char *end)
+{
+    ShlexQuoteCache *cache = s->quote_cache;
+    size_t n = end - str;
+    size_t hash = shlex__hash(str, n);
+    ShlexQuoteCacheEntry *entry = &cache->entries[hash & (SHLEX_QUOTE_CACHE_ENTRIES - 1)];
+    if (entry->data != NULL && entry->hash == hash && entry->size == n && entry->quoting == s->quoting &&
+        memcmp(entry->data, str, n) == 0) {
+#ifdef SHLEX_STATS
+        s->stats.quote_cache_hits += 1;
+#endif // SHLEX_STATS
+        shlex__string_append_sized(s, entry->data + n, entry->quoted_size);
+        return;
+    }
+#ifdef SHLEX_STATS
+    s->stats.quote_cache_misses += 1;
+#endif // SHLEX_STATS
+
+    size_t start = s->string_count;
+    shlex__append_unsafe(s, str, unsafe, end);
+    size_t quoted_size = s->string_count - start;
+    if (entry->capacity < n + quoted_size) {
+        // The old contents are not needed, so there is nothing to copy over
+        shlex__free(cache->allocator, entry->data, entry->capacity);
+        entry->data = (char*)shlex__realloc(cache->allocator, NULL, 0, n + quoted_size);
+        entry->capacity = n + quoted_size;
+    }
+    memcpy(entry->data, str, n);
+    memcpy(entry->data + n, s->string + start, quoted_size);
+    entry->size = n;
+    entry->quoted_size = quoted_size;
+    entry->hash = hash;
+    entry->quoting = s->quoting;
+}
+
+void shlex_quote_cache_free(ShlexQuoteCache *cache)
+{
+    const ShlexAllocator *allocator = cache->allocator;
+    for (size_t i = 0; i < SHLEX_QUOTE_CACHE_ENTRIES; ++i) {
+        shlex__free(allocator, cache->entries[i].data, cache->entries[i].capacity);
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->allocator = allocator;
+}
+
+char *shlex_join(Shlex *s)
+{
+    shlex__string_append_sized(s, "", 1);
+    s->string_count = 0; // Resetting the string storage so it can be reused for more shlex_append_quoted[_sized](..)
+    return s->string;
+}
+
+bool shlex_open_file(ShlexFile *f, const char *path)
+{
+    memset(f, 0, sizeof(*f));
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Empty files cannot be mapped, but there is nothing to split in them anyway
+    if (size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            CloseHandle(file);
+            return false;
+        }
+        f->data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        // The view keeps the mapping alive on its own
+        CloseHandle(mapping);
+        if (f->data == NULL) {
+            CloseHandle(file);
+            return false;
+        }
+        f->size = (size_t)size.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    // Empty files cannot be mapped, but there is nothing to split in them anyway
+    if (statbuf.st_size > 0) {
+        void *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return false;
+        }
+        f->data = (const char*)data;
+        f->size = statbuf.st_size;
+    }
+    // The mapping keeps the file alive on its own
+    close(fd);
+#endif // _WIN32
+    f->point = f->data;
+    return true;
+}
+
+bool shlex_next_line(ShlexFile *f, Shlex *s)
+{
+    const char *end = f->data + f->size;
+    if (f->point >= end) return false;
+
+    const char *line = f->point;
+    const char *line_end = (const char*)memchr(line, '\n', end - line);
+    if (line_end == NULL) line_end = end;
+    f->point = line_end < end ? line_end + 1 : end;
+
+    shlex_init(s, line, line_end);
+    return true;
+}
+
+void shlex_close_file(ShlexFile *f)
+{
+    if (f->data != NULL) {
+#ifdef _WIN32
+        UnmapViewOfFile(f->data);
+#else
+        munmap((void*)f->data, f->size);
+#endif // _WIN32
+    }
+    memset(f, 0, sizeof(*f));
+}
+
+char **shlex_split(const char *source, const char *source_end, ShlexArgv *argv)
+{
+    // Each token is followed by at least one whitespace except the last one, so this also covers the NULL-terminators
+    size_t data_capacity = source_end - source + 1;
+    if (argv->data_capacity < data_capacity) {
+        argv->data = (char*)shlex__realloc(argv->allocator, argv->data, argv->data_capacity, data_capacity);
+        argv->data_capacity = data_capacity;
+    }
+    // For the same reason every token takes at least two bytes of the source except the last one,
+    // so there are at most (n + 1)/2 of them plus the NULL at the end.
+    size_t items_capacity = (source_end - source + 1)/2 + 1;
+    if (argv->items_capacity < items_capacity) {
+        argv->items = (char**)shlex__realloc(argv->allocator, argv->items,
+                                             argv->items_capacity*sizeof(*argv->items),
+                                             items_capacity*sizeof(*argv->items));
+        argv->items_capacity = items_capacity;
+    }
+    argv->count = 0;
+
+    shlex__split_into(argv, 0, source, source_end);
+    assert(argv->count < items_capacity);
+    shlex__argv_push(argv, NULL);
+    argv->count -= 1;
+    return argv->items;
+}
+
+// Appends the tokens of [source, source_end) to argv->data starting from data_count and pushes them to argv->items.
+// The caller must make sure argv->data has enough room for them, so it never needs to grow and the items
+// pointing into it stay valid. Returns the new count of bytes in argv->data.
+static size_t shlex__split_into(ShlexArgv *argv, size_t data_count, const char *source, const char *source_end)
+{
+    Shlex s;
+    memset(&s, 0, sizeof(s));
+    s.string = argv->data;
+    s.string_count = data_count;
+    s.string_capacity = argv->data_capacity;
+    s.source = source;
+    s.source_end = source_end;
+    s.point = source;
+    for (;;) {
+        shlex__skip_whitespace(&s);
+        if (s.point >= s.source_end) break;
+        size_t start = s.string_count;
+        shlex__next_token(&s);
+        shlex__argv_push(argv, argv->data + start);
+    }
+    assert(s.string == argv->data);
+    return s.string_count;
+}
+
+#ifdef SHLEX_THREADS
+typedef struct {
+    pthread_t thread;
+    bool spawned;
+} Shlex__Worker;
+#endif // SHLEX_THREADS
+
+// Calls job(..) for each of the jobs_count jobs of jobs_size bytes each. If SHLEX_THREADS is defined every
+// job but the first one gets its own thread, and the first one is done by the calling thread meanwhile.
+static void shlex__run_jobs(const ShlexAllocator *allocator, void *(*job)(void*), void *jobs, size_t job_size, size_t jobs_count)
+{
+    char *jobs_bytes = (char*)jobs;
+#ifdef SHLEX_THREADS
+    Shlex__Worker *workers = (Shlex__Worker*)shlex__realloc(allocator, NULL, 0, jobs_count*sizeof(*workers));
+    for (size_t i = 1; i < jobs_count; ++i) {
+        workers[i].spawned = pthread_create(&workers[i].thread, NULL, job, jobs_bytes + i*job_size) == 0;
+        // Could not spawn the thread, so doing its job ourselves
+        if (!workers[i].spawned) job(jobs_bytes + i*job_size);
+    }
+    job(jobs_bytes);
+    for (size_t i = 1; i < jobs_count; ++i) {
+        if (workers[i].spawned) pthread_join(workers[i].thread, NULL);
+    }
+    shlex__free(allocator, workers, jobs_count*sizeof(*workers));
+#else
+    (void) allocator;
+    for (size_t i = 0; i < jobs_count; ++i) job(jobs_bytes + i*job_size);
+#endif // SHLEX_THREADS
+}
+
+typedef struct {
+    ShlexArgv *part;
+    const char *begin;
+    const char *end;
+} Shlex__Lines_Job;
+
+// Splits the lines of the job into job->part. Each line is followed by a NULL in job->part->items.
+static void *shlex__split_lines_job(void *arg)
+{
+    Shlex__Lines_Job *job = (Shlex__Lines_Job*)arg;
+    ShlexArgv *part = job->part;
+
+    // Each line takes at most its length plus one NULL-terminator, and all of them but the last one are
+    // followed by a '\n' that is not copied. So the length of the job plus one is always enough.
+    size_t data_capacity = job->end - job->begin + 1;
+    if (part->data_capacity < data_capacity) {
+        part->data = (char*)shlex__realloc(part->allocator, part->data, part->data_capacity, data_capacity);
+        part->data_capacity = data_capacity;
+    }
+    part->count = 0;
+
+    size_t data_count = 0;
+    const char *line = job->begin;
+    while (line < job->end) {
+        const char *line_end = shlex__find_line_end(line, job->end);
+        data_count = shlex__split_into(part, data_count, line, line_end);
+        shlex__argv_push(part, NULL);
+        line = line_end < job->end ? line_end + 1 : job->end;
+    }
+    return NULL;
+}
+
+void shlex_split_lines(const char *source, const char *source_end, size_t threads, ShlexLines *lines)
+{
+#ifndef SHLEX_THREADS
+    threads = 1;
+#endif // SHLEX_THREADS
+    if (threads == 0) threads = 1;
+
+    if (lines->parts_count < threads) {
+        lines->parts = (ShlexArgv*)shlex__realloc(lines->allocator, lines->parts,
+                                                  lines->parts_count*sizeof(*lines->parts),
+                                                  threads*sizeof(*lines->parts));
+        memset(lines->parts + lines->parts_count, 0, (threads - lines->parts_count)*sizeof(*lines->parts));
+        lines->parts_count = threads;
+    }
+
+    // Dividing the source into the jobs at the ends of the lines closest to the even split.
+    // This has to be done from the beginning to keep track of the quotes.
+    Shlex__Lines_Job *jobs = (Shlex__Lines_Job*)shlex__realloc(lines->allocator, NULL, 0, threads*sizeof(*jobs));
+    const char *begin = source;
+    for (size_t i = 0; i < threads; ++i) {
+        const char *end = source_end;
+        if (i + 1 < threads) {
+            const char *target = source + (source_end - source)*(i + 1)/threads;
+            end = begin;
+            while (end < target) {
+                const char *line_end = shlex__find_line_end(end, source_end);
+                end = line_end < source_end ? line_end + 1 : source_end;
+            }
+        }
+        lines->parts[i].allocator = lines->allocator;
+        jobs[i].part = &lines->parts[i];
+        jobs[i].begin = begin;
+        jobs[i].end = end;
+        begin = end;
+    }
+
+    shlex__run_jobs(lines->allocator, shlex__split_lines_job, jobs, sizeof(*jobs), threads);
+    shlex__free(lines->allocator, jobs, threads*sizeof(*jobs));
+
+    // Collecting the lines of all the parts in order
+    size_t lines_count = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        ShlexArgv *part = &lines->parts[i];
+        for (size_t j = 0; j < part->count; ++j) {
+            if (part->items[j] == NULL) lines_count += 1;
+        }
+    }
+    if (lines->lines_capacity < lines_count) {
+        lines->lines = (char***)shlex__realloc(lines->allocator, lines->lines,
+                                               lines->lines_capacity*sizeof(*lines->lines),
+                                               lines_count*sizeof(*lines->lines));
+        lines->lines_capacity = lines_count;
+    }
+    lines->lines_count = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        ShlexArgv *part = &lines->parts[i];
+        size_t line = 0;
+        for (size_t j = 0; j < part->count; ++j) {
+            if (part->items[j] == NULL) {
+                lines->lines[lines->lines_count++] = part->items + line;
+                line = j + 1;
+            }
+        }
+    }
+}
+
+void shlex_lines_free(ShlexLines *lines)
+{
+    const ShlexAllocator *allocator = lines->allocator;
+    for (size_t i = 0; i < lines->parts_count; ++i) {
+        shlex_argv_free(&lines->parts[i]);
+    }
+    shlex__free(allocator, lines->parts, lines->parts_count*sizeof(*lines->parts));
+    shlex__free(allocator, lines->lines, lines->lines_capacity*sizeof(*lines->lines));
+    memset(lines, 0, sizeof(*lines));
+    lines->allocator = allocator;
+}
+
+// Finds the end of the token starting at p the same way shlex__next_token(..) does but without copying anything.
+// Tells whether the token has anything to unquote in *needs_unescape. If the token runs off the end of the source
+// in the middle of the quotes or right after a <backslash>, the error shlex__next_token(..) would report and
+// the character that caused it are put into *error and *error_point.
+static const char *shlex__skip_token(const char *p, const char *end, bool *needs_unescape, ShlexError *error, const char **error_point)
+{
+    *needs_unescape = false;
+    for (;;) {
+        p = shlex__find_special(p, end);
+        if (p >= end || shlex__is(*p, SHLEX__CC_SPACE)) return p;
+
+        *needs_unescape = true;
+        const char *special = p;
+        switch (*p++) {
+        case '\\':
+            if (p < end) {
+                p++;
+            } else {
+                *error = SHLEX_ERROR_TRAILING_BACKSLASH;
+                *error_point = special;
+            }
+            break;
+        case '\'':
+            p = (const char*)memchr(p, '\'', end - p);
+            if (p == NULL) {
+                *error = SHLEX_ERROR_UNTERMINATED_SINGLE_QUOTE;
+                *error_point = special;
+                return end;
+            }
+            p++;
+            break;
+        case '"':
+            while (p < end && *p != '"') {
+                if (*p == '\\' && end - p >= 2) p++;
+                p++;
+            }
+            if (p < end) {
+                p++;
+            } else {
+                *error = SHLEX_ERROR_UNTERMINATED_DOUBLE_QUOTE;
+                *error_point = special;
+            }
+            break;
+        default:
+            assert(0 && "UNREACHABLE");
+        }
+    }
+}
+
+// The states of the quoting state machine of shlex__next_token(..) as seen by shlex__scan_states(..).
+enum {
+    SHLEX__STATE_NONE,
+    SHLEX__STATE_SINGLE,
+    SHLEX__STATE_DOUBLE,
+    SHLEX__STATE_NONE_ESCAPED,
+    SHLEX__STATE_DOUBLE_ESCAPED,
+    SHLEX__STATE_COUNT,
+};
+
+typedef struct {
+    const char *begin;
+    const char *end;
+
+    // Phase one: the state at the end of the chunk for each state at its beginning, and whether a token
+    // goes on past the end of the chunk in that case.
+    int end_state[SHLEX__STATE_COUNT];
+    bool end_in_token[SHLEX__STATE_COUNT];
+
+    // Phase two: the pieces of the tokens of the chunk lexed from the actual state at its beginning.
+    // The first piece continues the token from the previous chunk if in_token, and the last one goes on
+    // into the next chunk if the lexer is still in_token at the end. The pieces.data and pieces.items are
+    // the regions of the data and the items of the resulting argv set aside for the chunk, so the job never
+    // allocates anything.
+    int state;
+    bool in_token;
+    bool last;
+    ShlexArgv pieces;
+    size_t pieces_size;
+    bool ends_in_token;
+} Shlex__Parallel_Job;
+
+static void *shlex__scan_state_job(void *arg)
+{
+    Shlex__Parallel_Job *job = (Shlex__Parallel_Job*)arg;
+    shlex__scan_states(job->begin, job->end, job->end_state, job->end_in_token);
+    return NULL;
+}
+
+static void *shlex__split_pieces_job(void *arg)
+{
+    Shlex__Parallel_Job *job = (Shlex__Parallel_Job*)arg;
+    ShlexArgv *pieces = &job->pieces;
+
+    Shlex s;
+    memset(&s, 0, sizeof(s));
+    s.string = pieces->data;
+    s.string_capacity = pieces->data_capacity;
+    s.source = job->begin;
+    s.source_end = job->end;
+    s.point = job->begin;
+    s.strlit = job->state == SHLEX__STATE_SINGLE ? '\'' :
+               job->state == SHLEX__STATE_DOUBLE || job->state == SHLEX__STATE_DOUBLE_ESCAPED ? '"' : 0;
+    s.escaped = job->state == SHLEX__STATE_NONE_ESCAPED || job->state == SHLEX__STATE_DOUBLE_ESCAPED;
+    s.in_token = job->in_token;
+    s.streaming = true;
+    s.finished = job->last;
+    for (;;) {
+        size_t start = s.string_count;
+        if (!s.in_token) {
+            shlex__skip_whitespace(&s);
+            if (s.point >= s.source_end) break;
+            s.in_token = true;
+        }
+        if (shlex__next_token(&s) == NULL) {
+            // The token goes on into the next chunk
+            shlex__string_append(&s, '\0');
+            shlex__argv_push(pieces, pieces->data + start);
+            break;
+        }
+        shlex__argv_push(pieces, pieces->data + start);
+    }
+    assert(s.string == pieces->data);
+    assert(pieces->count <= pieces->items_capacity);
+    job->pieces_size = s.string_count;
+    job->ends_in_token = s.in_token;
+    return NULL;
+}
+
+char **shlex_split_parallel(const char *source, const char *source_end, size_t threads, ShlexArgv *argv)
+{
+#ifndef SHLEX_THREADS
+    threads = 1;
+#endif // SHLEX_THREADS
+    size_t n = source_end - source;
+    if (threads > n) threads = n;
+    if (threads <= 1) return shlex_split(source, source_end, argv);
+
+    // Just like in shlex_split(..) the tokens don't take more than the chunk itself, except the
+    // <backslash> which was left pending by the previous chunk may produce one more byte, and the
+    // NULL-terminator of the piece continued by the next chunk. So every chunk gets a region of two
+    // more bytes than itself in the data of argv, reused across the calls like in shlex_split(..).
+    size_t data_capacity = n + 2*threads;
+    if (argv->data_capacity < data_capacity) {
+        argv->data = (char*)shlex__realloc(argv->allocator, argv->data, argv->data_capacity, data_capacity);
+        argv->data_capacity = data_capacity;
+    }
+    // A chunk of m bytes has at most (m + 1)/2 + 1 pieces for the same reason as in shlex_split(..),
+    // the extra one being the piece that continues the token of the previous chunk.
+    size_t items_capacity = 1;
+    for (size_t i = 0; i < threads; ++i) items_capacity += (n*(i + 1)/threads - n*i/threads + 1)/2 + 1;
+    if (argv->items_capacity < items_capacity) {
+        argv->items = (char**)shlex__realloc(argv->allocator, argv->items,
+                                             argv->items_capacity*sizeof(*argv->items),
+                                             items_capacity*sizeof(*argv->items));
+        argv->items_capacity = items_capacity;
+    }
+    argv->count = 0;
+
+    Shlex__Parallel_Job *jobs = (Shlex__Parallel_Job*)shlex__realloc(argv->allocator, NULL, 0, threads*sizeof(*jobs));
+    memset(jobs, 0, threads*sizeof(*jobs));
+    size_t items_count = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        jobs[i].begin = source + n*i/threads;
+        jobs[i].end = source + n*(i + 1)/threads;
+        jobs[i].last = i + 1 == threads;
+        jobs[i].pieces.allocator = argv->allocator;
+        jobs[i].pieces.data = argv->data + (jobs[i].begin - source) + 2*i;
+        jobs[i].pieces.data_capacity = jobs[i].end - jobs[i].begin + 2;
+        jobs[i].pieces.items = argv->items + items_count;
+        jobs[i].pieces.items_capacity = (jobs[i].end - jobs[i].begin + 1)/2 + 1;
+        items_count += jobs[i].pieces.items_capacity;
+    }
+
+    shlex__run_jobs(argv->allocator, shlex__scan_state_job, jobs, sizeof(*jobs), threads);
+    int state = SHLEX__STATE_NONE;
+    bool in_token = false;
+    for (size_t i = 0; i < threads; ++i) {
+        jobs[i].state = state;
+        jobs[i].in_token = in_token;
+        in_token = jobs[i].end_in_token[state];
+        state = jobs[i].end_state[state];
+    }
+    shlex__run_jobs(argv->allocator, shlex__split_pieces_job, jobs, sizeof(*jobs), threads);
+
+    // Stitching the pieces together in place. The stitched tokens never take more than the regions of
+    // the chunks before, so the pieces and their items only ever move to the left, and each item is read
+    // before anything is written over it.
+    size_t data_count = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        ShlexArgv *pieces = &jobs[i].pieces;
+        for (size_t j = 0; j < pieces->count; ++j) {
+            const char *piece = pieces->items[j];
+            const char *piece_end = j + 1 < pieces->count ? pieces->items[j + 1] : pieces->data + jobs[i].pieces_size;
+            size_t piece_size = piece_end - piece - 1;
+            if (j == 0 && jobs[i].in_token) {
+                // Dropping the NULL-terminator of the previous piece
+                data_count -= 1;
+            } else {
+                shlex__argv_push(argv, argv->data + data_count);
+            }
+            memmove(argv->data + data_count, piece, piece_size);
+            data_count += piece_size;
+            argv->data[data_count++] = '\0';
+        }
+        // The phase one must have predicted exactly what the lexer ended up doing
+        assert(jobs[i].last || jobs[i].ends_in_token == jobs[i + 1].in_token);
+    }
+    shlex__free(argv->allocator, jobs, threads*sizeof(*jobs));
+
+    shlex__argv_push(argv, NULL);
+    argv->count -= 1;
+    return argv->items;
+}
+
+// Makes one step of the quoting state machine of shlex__next_token(..) from p in *state without producing
+// any tokens. Returns the position after the step.
+static const char *shlex__scan_step(const char *p, const char *end, int *state, bool *last_escaped)
+{
+    switch (*state) {
+    case SHLEX__STATE_NONE:
+        p = shlex__find_structural(p, end);
+        if (p >= end) break;
+        switch (*p++) {
+        case '\\': *state = SHLEX__STATE_NONE_ESCAPED; break;
+        case '\'':  *state = SHLEX__STATE_SINGLE;       break;
+        case '"':   *state = SHLEX__STATE_DOUBLE;       break;
+        }
+        break;
+    case SHLEX__STATE_SINGLE:
+        p = (const char*)memchr(p, '\'', end - p);
+        if (p == NULL) return end;
+        p++;
+        *state = SHLEX__STATE_NONE;
+        break;
+    case SHLEX__STATE_DOUBLE:
+        p = shlex__find_structural(p, end);
+        if (p >= end) break;
+        switch (*p++) {
+        case '\\': *state = SHLEX__STATE_DOUBLE_ESCAPED; break;
+        case '"':   *state = SHLEX__STATE_NONE;           break;
+        }
+        break;
+    case SHLEX__STATE_NONE_ESCAPED:
+        p++;
+        *last_escaped = p == end;
+        *state = SHLEX__STATE_NONE;
+        break;
+    case SHLEX__STATE_DOUBLE_ESCAPED:
+        p++;
+        *state = SHLEX__STATE_DOUBLE;
+        break;
+    default:
+        assert(0 && "UNREACHABLE");
+    }
+    return p;
+}
+
+// Runs the quoting state machine over the non-empty [begin, end) from every state at once in a single pass.
+// Stores the state at the end for each state at the beginning, and whether the last token goes on past the end.
+//
+// The escaped states become their base state after one byte, and two trajectories that meet in the same state
+// at the same position go on the same way, so the later one just follows the other one from then on. On any
+// quote the trajectories usually meet, so the rest of the chunk is scanned only once.
+static void shlex__scan_states(const char *begin, const char *end, int *end_state, bool *end_in_token)
+{
+    assert(begin < end);
+    const char *p[SHLEX__STATE_COUNT];
+    int state[SHLEX__STATE_COUNT];
+    bool last_escaped[SHLEX__STATE_COUNT];
+    int follows[SHLEX__STATE_COUNT];
+    for (int i = 0; i < SHLEX__STATE_COUNT; ++i) {
+        p[i] = begin;
+        state[i] = i;
+        last_escaped[i] = false;
+        follows[i] = i;
+    }
+    p[SHLEX__STATE_NONE_ESCAPED] = begin + 1;
+    state[SHLEX__STATE_NONE_ESCAPED] = SHLEX__STATE_NONE;
+    last_escaped[SHLEX__STATE_NONE_ESCAPED] = begin + 1 == end;
+    p[SHLEX__STATE_DOUBLE_ESCAPED] = begin + 1;
+    state[SHLEX__STATE_DOUBLE_ESCAPED] = SHLEX__STATE_DOUBLE;
+
+    for (;;) {
+        // Stepping the trajectory that is the furthest behind keeps all of them in lockstep
+        int t = -1;
+        for (int i = 0; i < SHLEX__STATE_COUNT; ++i) {
+            if (follows[i] == i && p[i] < end && (t < 0 || p[i] < p[t])) t = i;
+        }
+        if (t < 0) break;
+        p[t] = shlex__scan_step(p[t], end, &state[t], &last_escaped[t]);
+        // At the very end the trajectories may still differ in last_escaped
+        if (p[t] >= end) continue;
+        for (int i = 0; i < SHLEX__STATE_COUNT; ++i) {
+            if (i != t && follows[i] == i && p[i] == p[t] && state[i] == state[t]) {
+                follows[t] = i;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < SHLEX__STATE_COUNT; ++i) {
+        int j = i;
+        while (follows[j] != j) j = follows[j];
+        end_state[i] = state[j];
+        // Outside of the quotes only an unescaped whitespace at the very end finishes the token
+        end_in_token[i] = state[j] != SHLEX__STATE_NONE || last_escaped[j] || !shlex__is(end[-1], SHLEX__CC_SPACE);
+    }
+}
+
+// Finds the '\n' that ends the line starting at p: the one outside of the quotes and not escaped with a <backslash>.
+// Returns end if the line is not terminated.
+static const char *shlex__find_line_end(const char *p, const char *end)
+{
+    char strlit = 0;
+    while (p < end) {
+        switch (strlit) {
+        case '\'':
+            p = (const char*)memchr(p, '\'', end - p);
+            if (p == NULL) return end;
+            strlit = 0;
+            p++;
+            break;
+        case '"':
+            while (p < end && *p != '"' && *p != '\\') p++;
+            if (p >= end) return end;
+            if (*p == '\\') {
+                p = end - p >= 2 ? p + 2 : end;
+            } else {
+                strlit = 0;
+                p++;
+            }
+            break;
+        default:
+            p = shlex__find_structural(p, end);
+            if (p >= end) return end;
+            switch (*p) {
+            case '\n': return p;
+            case '\\':
+                p = end - p >= 2 ? p + 2 : end;
+                break;
+            default:
+                strlit = *p;
+                p++;
+            }
+        }
+    }
+    return end;
+}
+
+void shlex_argv_free(ShlexArgv *argv)
+{
+    const ShlexAllocator *allocator = argv->allocator;
+    shlex__free(allocator, argv->items, argv->items_capacity*sizeof(*argv->items));
+    shlex__free(allocator, argv->data, argv->data_capacity);
+    memset(argv, 0, sizeof(*argv));
+    argv->allocator = allocator;
+}
+
+static void shlex__argv_push(ShlexArgv *argv, char *item)
+{
+    if (argv->count >= argv->items_capacity) {
+        size_t items_capacity = argv->items_capacity == 0 ? 16 : argv->items_capacity*2;
+        argv->items = (char**)shlex__realloc(argv->allocator, argv->items,
+                                             argv->items_capacity*sizeof(*argv->items),
+                                             items_capacity*sizeof(*argv->items));
+        argv->items_capacity = items_capacity;
+    }
+    argv->items[argv->count++] = item;
+}
+
+void shlex_reserve(Shlex *s, size_t n)
+{
+    // Unlike shlex__string_reserve(..) allocates exactly as much as requested, since the caller knows better.
+    if (s->string_count + n > s->string_capacity) {
+        shlex__string_resize(s, s->string_count + n);
+    }
+}
+
+// Makes sure n more bytes fit into the string storage growing it geometrically if needed,
+// so the appends after it can just copy without checking the capacity for each byte.
+static void shlex__string_reserve(Shlex *s, size_t n)
+{
+    size_t required = s->string_count + n;
+    if (required > s->string_capacity) {
+        const ShlexGrowth *growth = &s->growth;
+        size_t string_capacity = s->string_capacity == 0 ? SHLEX_INLINE_CAPACITY : s->string_capacity;
+        // Leaving the inline buffer for the initial heap allocation
+        if (string_capacity <= SHLEX_INLINE_CAPACITY && required <= growth->initial) string_capacity = growth->initial;
+        size_t percent = growth->percent == 0 ? 100 : growth->percent;
+        while (required > string_capacity) {
+            size_t step = string_capacity*percent/100;
+            if (step == 0) step = 1;
+            if (growth->max_step > 0 && step >= growth->max_step) {
+                // From now on the steps are all the same, so no need to make them one by one
+                string_capacity += (required - string_capacity + growth->max_step - 1)/growth->max_step*growth->max_step;
+                break;
+            }
+            string_capacity += step;
+        }
+        shlex__string_resize(s, string_capacity);
+    }
+}
+
+void shlex_shrink(Shlex *s, size_t keep)
+{
+    size_t string_capacity = keep > s->string_count ? keep : s->string_count;
+    if (s->string != NULL && s->string != s->inline_string && string_capacity < s->string_capacity) {
+        shlex__string_resize(s, string_capacity);
+    }
+}
+
+// Moves the string storage into a block of the given capacity. Everything that fits stays in s->inline_string
+// and the first heap allocation copies the contents over from there. Shrinking the heap storage so it fits
+// into s->inline_string moves the contents back and deallocates it.
+static void shlex__string_resize(Shlex *s, size_t string_capacity)
+{
+    if (s->string != NULL && s->string != s->inline_string && string_capacity <= SHLEX_INLINE_CAPACITY) {
+        memcpy(s->inline_string, s->string, s->string_count);
+        shlex__free(s->allocator, s->string, s->string_capacity);
+        s->string = s->inline_string;
+        s->string_capacity = SHLEX_INLINE_CAPACITY;
+        return;
+    }
+
+    if (s->string == NULL || s->string == s->inline_string) {
+        if (string_capacity <= SHLEX_INLINE_CAPACITY) {
+            s->string = s->inline_string;
+            s->string_capacity = SHLEX_INLINE_CAPACITY;
+#ifdef SHLEX_STATS
+            if (s->stats.peak_capacity < SHLEX_INLINE_CAPACITY) s->stats.peak_capacity = SHLEX_INLINE_CAPACITY;
+#endif // SHLEX_STATS
+            return;
+        }
+        char *string = (char*)shlex__realloc(s->allocator, NULL, 0, string_capacity);
+        if (s->string != NULL) memcpy(string, s->string, s->string_count);
+        s->string = string;
+    } else {
+        s->string = (char*)shlex__realloc(s->allocator, s->string, s->string_capacity, string_capacity);
+    }
+    s->string_capacity = string_capacity;
+#ifdef SHLEX_STATS
+    s->stats.reallocs += 1;
+    if (s->stats.peak_capacity < string_capacity) s->stats.peak_capacity = string_capacity;
+#endif // SHLEX_STATS
+}
+
+static void *shlex__realloc(const ShlexAllocator *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+    if (allocator == NULL) return SHLEX_REALLOC(ptr, new_size);
+    return allocator->realloc(allocator->ctx, ptr, old_size, new_size);
+}
+
+static void shlex__free(const ShlexAllocator *allocator, void *ptr, size_t size)
+{
+    if (allocator == NULL) {
+        SHLEX_FREE(ptr);
+    } else if (allocator->free != NULL) {
+        allocator->free(allocator->ctx, ptr, size);
+    }
+}
+
+size_t shlex_quoted_len(const char *str, size_t n)
+{
+    return shlex_quoted_len_with(str, n, SHLEX_QUOTE_SINGLE);
+}
+
+size_t shlex_quoted_len_with(const char *str, size_t n, ShlexQuoting quoting)
+{
+    if (n == 0) return 2;
+
+    const char *end = str + n;
+    const char *quote = shlex__find_unsafe(str, end);
+    if (quote >= end) return n;
+
+    if (quoting == SHLEX_QUOTE_MINIMAL) {
+        Shlex__Quote_Counts counts = shlex__count_quotes(quote, end);
+        size_t len;
+        shlex__pick_encoding(&counts, n, &len);
+        return len;
+    }
+
+    size_t quotes = 0;
+    while ((quote = (const char*)memchr(quote, '\'', end - quote)) != NULL) {
+        quotes += 1;
+        quote += 1;
+    }
+
+    // Each single-quote turns into '"'"'
+    return n + 2 + quotes*4;
+}
+
+char *shlex_join_argv(Shlex *s, char **argv, size_t argc)
+{
+    size_t n = 1; // NULL-terminator
+    for (size_t i = 0; i < argc; ++i) {
+        if (i > 0 || s->string_count > 0) n += 1; // Separator
+        n += shlex_quoted_len_with(argv[i], strlen(argv[i]), s->quoting);
+    }
+    shlex_reserve(s, n);
+
+    for (size_t i = 0; i < argc; ++i) {
+        shlex_append_quoted(s, argv[i]);
+    }
+    return shlex_join(s);
+}
+
+char *shlex_join_batch(Shlex *s, char **const *argvs, const size_t *argcs, size_t count, size_t *offsets)
+{
+    s->string_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i] = s->string_count;
+        char **argv = argvs[i];
+        for (size_t j = 0; argcs != NULL ? j < argcs[i] : argv[j] != NULL; ++j) {
+            size_t n = strlen(argv[j]);
+            shlex__string_reserve(s, n + 1);
+            if (j > 0) shlex__string_append(s, ' ');
+            shlex__append_quoted(s, argv[j], n);
+        }
+        shlex__string_append(s, '\0');
+    }
+    offsets[count] = s->string_count;
+    s->string_count = 0;
+    // Even an empty batch gets a valid storage
+    shlex__string_reserve(s, 1);
+    return s->string;
+}
+
+// Zero sized pieces are skipped so the sinks never see them.
+static inline bool shlex__write(ShlexWrite write, void *ctx, const char *data, size_t size)
+{
+    return size == 0 || write(ctx, data, size);
+}
+
+// Same as shlex_append_quoted_sized(..) but writes the argument piece by piece into write(..).
+static bool shlex__write_quoted(const char *str, size_t n, ShlexQuoting quoting, ShlexWrite write, void *ctx)
+{
+    if (n == 0) return shlex__write(write, ctx, "''", 2);
+
+    const char *end = str + n;
+    const char *unsafe = shlex__find_unsafe(str, end);
+    if (unsafe >= end) return shlex__write(write, ctx, str, n);
+
+    Shlex__Encoding encoding = SHLEX__ENCODING_SINGLE;
+    if (quoting == SHLEX_QUOTE_MINIMAL) {
+        Shlex__Quote_Counts counts = shlex__count_quotes(unsafe, end);
+        encoding = shlex__pick_encoding(&counts, n, NULL);
+    }
+
+    switch (encoding) {
+    case SHLEX__ENCODING_SINGLE: {
+        if (!shlex__write(write, ctx, "'", 1)) return false;
+        // The safe prefix has no single-quotes, so searching for them starts from the first unsafe character
+        const char *quote;
+        while ((quote = (const char*)memchr(unsafe, '\'', end - unsafe)) != NULL) {
+            if (!shlex__write(write, ctx, str, quote - str)) return false;
+            if (!shlex__write(write, ctx, "'\"'\"'", 5)) return false;
+            str = unsafe = quote + 1;
+        }
+        if (!shlex__write(write, ctx, str, end - str)) return false;
+        return shlex__write(write, ctx, "'", 1);
+    }
+    case SHLEX__ENCODING_DOUBLE: {
+        if (!shlex__write(write, ctx, "\"", 1)) return false;
+        for (const char *p = unsafe; p < end; ++p) {
+            if (*p == '\\' || *p == '$' || *p == '`' || *p == '"') {
+                // The special character itself goes out together with the run that follows it
+                if (!shlex__write(write, ctx, str, p - str)) return false;
+                if (!shlex__write(write, ctx, "\\", 1)) return false;
+                str = p;
+            }
+        }
+        if (!shlex__write(write, ctx, str, end - str)) return false;
+        return shlex__write(write, ctx, "\"", 1);
+    }
+    case SHLEX__ENCODING_BACKSLASH: {
+        while (unsafe < end) {
+            if (!shlex__write(write, ctx, str, unsafe - str)) return false;
+            if (!shlex__write(write, ctx, "\\", 1)) return false;
+            str = unsafe;
+            unsafe = shlex__find_unsafe(unsafe + 1, end);
+        }
+        return shlex__write(write, ctx, str, end - str);
+    }
+    }
+    return false;
+}
+
+bool shlex_join_to(char **argv, size_t argc, ShlexQuoting quoting, ShlexWrite write, void *ctx)
+{
+    for (size_t i = 0; i < argc; ++i) {
+        if (i > 0 && !shlex__write(write, ctx, " ", 1)) return false;
+        if (!shlex__write_quoted(argv[i], strlen(argv[i]), quoting, write, ctx)) return false;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+// The pieces of shlex_join_to(..) waiting to be written with a single writev(..). Way below IOV_MAX on any system.
+#define SHLEX__IOV_CAPACITY 64
+
+typedef struct {
+    int fd;
+    struct iovec iov[SHLEX__IOV_CAPACITY];
+    size_t iov_count;
+} Shlex__Fd_Sink;
+
+static bool shlex__fd_sink_flush(Shlex__Fd_Sink *sink)
+{
+    struct iovec *iov = sink->iov;
+    size_t iov_count = sink->iov_count;
+    sink->iov_count = 0;
+    while (iov_count > 0) {
+        ssize_t written = writev(sink->fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // Skipping whatever was written, the last piece may have been written just partially
+        while (iov_count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+static bool shlex__fd_sink_write(void *ctx, const char *data, size_t size)
+{
+    Shlex__Fd_Sink *sink = (Shlex__Fd_Sink*)ctx;
+    if (sink->iov_count >= SHLEX__IOV_CAPACITY && !shlex__fd_sink_flush(sink)) return false;
+    sink->iov[sink->iov_count].iov_base = (void*)data;
+    sink->iov[sink->iov_count].iov_len = size;
+    sink->iov_count += 1;
+    return true;
+}
+
+bool shlex_join_fd(int fd, char **argv, size_t argc, ShlexQuoting quoting)
+{
+    Shlex__Fd_Sink sink;
+    sink.fd = fd;
+    sink.iov_count = 0;
+    if (!shlex_join_to(argv, argc, quoting, shlex__fd_sink_write, &sink)) return false;
+    return shlex__fd_sink_flush(&sink);
+}
+#endif // _WIN32
+
+void shlex_pool_init(ShlexPool *pool, size_t high_water, const ShlexAllocator *allocator)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->high_water = high_water;
+    pool->allocator = allocator;
+#ifdef SHLEX_THREADS
+    pthread_mutex_init(&pool->mutex, NULL);
+#endif // SHLEX_THREADS
+}
+
+Shlex *shlex_pool_acquire(ShlexPool *pool)
+{
+    Shlex *s = NULL;
+#ifdef SHLEX_THREADS
+    pthread_mutex_lock(&pool->mutex);
+#endif // SHLEX_THREADS
+    if (pool->count > 0) s = pool->items[--pool->count];
+#ifdef SHLEX_THREADS
+    pthread_mutex_unlock(&pool->mutex);
+#endif // SHLEX_THREADS
+
+    // Allocating outside of the lock, so the other threads don't wait for the allocator
+    if (s == NULL) {
+        s = (Shlex*)shlex__realloc(pool->allocator, NULL, 0, sizeof(*s));
+        memset(s, 0, sizeof(*s));
+        s->allocator = pool->allocator;
+    }
+    s->growth = pool->growth;
+    return s;
+}
+
+void shlex_pool_release(ShlexPool *pool, Shlex *s)
+{
+    shlex_reset(s);
+    s->track_lines = false;
+    s->comments = false;
+    s->punctuation = false;
+    s->quoting = SHLEX_QUOTE_SINGLE;
+    s->quote_cache = NULL;
+    if (pool->high_water > 0 && s->string_capacity > pool->high_water) {
+        shlex_shrink(s, 0);
+    }
+
+#ifdef SHLEX_THREADS
+    pthread_mutex_lock(&pool->mutex);
+#endif // SHLEX_THREADS
+    if (pool->count >= pool->capacity) {
+        size_t capacity = pool->capacity == 0 ? 16 : pool->capacity*2;
+        pool->items = (Shlex**)shlex__realloc(pool->allocator, pool->items,
+                                              pool->capacity*sizeof(*pool->items),
+                                              capacity*sizeof(*pool->items));
+        pool->capacity = capacity;
+    }
+    pool->items[pool->count++] = s;
+#ifdef SHLEX_THREADS
+    pthread_mutex_unlock(&pool->mutex);
+#endif // SHLEX_THREADS
+}
+
+void shlex_pool_free(ShlexPool *pool)
+{
+    for (size_t i = 0; i < pool->count; ++i) {
+        shlex_free(pool->items[i]);
+        shlex__free(pool->allocator, pool->items[i], sizeof(*pool->items[i]));
+    }
+    shlex__free(pool->allocator, pool->items, pool->capacity*sizeof(*pool->items));
+#ifdef SHLEX_THREADS
+    pthread_mutex_destroy(&pool->mutex);
+#endif // SHLEX_THREADS
+    memset(pool, 0, sizeof(*pool));
+}
+
+void shlex_stream_init(ShlexStream *st, ShlexCommand command, void *ctx)
+{
+    memset(st, 0, sizeof(*st));
+    st->command = command;
+    st->ctx = ctx;
+}
+
+// Same as shlex__skip_blank(..) but stops right after the first newline and returns true if it got there,
+// since outside of a token it ends the command line.
+static bool shlex__skip_blank_line(Shlex *s)
+{
+    for (;;) {
+        if (s->in_comment) {
+            const char *newline = (const char*)memchr(s->point, '\n', s->source_end - s->point);
+            if (newline == NULL) {
+                s->point = s->source_end;
+                return false;
+            }
+            s->point = newline;
+            s->in_comment = false;
+        }
+        while (s->point < s->source_end && *s->point != '\n' && shlex__is(*s->point, SHLEX__CC_SPACE)) {
+            s->point++;
+        }
+        if (s->point >= s->source_end) return false;
+        if (*s->point == '\n') {
+            s->point++;
+            return true;
+        }
+        if (!s->comments || *s->point != '#') return false;
+        s->in_comment = true;
+    }
+}
+
+// Hands the collected command line over to st->command(..) and starts the next one. The blank lines are skipped.
+static void shlex__stream_command(ShlexStream *st)
+{
+    Shlex *s = &st->lexer;
+    if (st->starts_count == 0) return;
+    for (size_t i = 0; i < st->starts_count; ++i) {
+        st->items[i] = s->string + st->starts[i];
+    }
+    st->items[st->starts_count] = NULL;
+    st->command(st->ctx, st->items, st->starts_count);
+    st->starts_count = 0;
+    s->string_count = 0;
+    // A giant command line is not a reason to keep its memory for the rest of the connection
+    if (s->growth.trim_above > 0 && s->string_capacity > s->growth.trim_above) shlex_shrink(s, 0);
+}
+
+// Runs the lexer over what is left of the current piece of the input. Works like shlex__split_into(..),
+// except the tokens of a command line are kept in the string storage until its newline.
+static void shlex__stream_drive(ShlexStream *st)
+{
+    Shlex *s = &st->lexer;
+    for (;;) {
+        if (!s->in_token) {
+            if (shlex__skip_blank_line(s)) {
+                shlex__stream_command(st);
+                continue;
+            }
+            if (s->point >= s->source_end) return;
+
+            if (st->starts_count >= st->starts_capacity) {
+                size_t starts_capacity = st->starts_capacity == 0 ? 16 : st->starts_capacity*2;
+                st->starts = (size_t*)shlex__realloc(s->allocator, st->starts,
+                                                     st->starts_capacity*sizeof(*st->starts),
+                                                     starts_capacity*sizeof(*st->starts));
+                st->items = (char**)shlex__realloc(s->allocator, st->items,
+                                                   (st->starts_capacity + 1)*sizeof(*st->items),
+                                                   (starts_capacity + 1)*sizeof(*st->items));
+                st->starts_capacity = starts_capacity;
+            }
+            st->starts[st->starts_count++] = s->string_count;
+            shlex__token_start(s);
+            s->in_token = true;
+            s->in_punct = s->punctuation && shlex__is(*s->point, SHLEX__CC_PUNCT);
+        }
+        if (shlex__next_token(s) == NULL) return;
+        s->token_end = s->source_offset + (s->point - s->source);
+    }
+}
+
+void shlex_stream_on_data(ShlexStream *st, const char *data, size_t size)
+{
+    shlex_feed(&st->lexer, data, size);
+    shlex__stream_drive(st);
+}
+
+void shlex_stream_on_eof(ShlexStream *st)
+{
+    shlex_finish(&st->lexer);
+    shlex__stream_drive(st);
+    shlex__stream_command(st);
+}
+
+char *shlex_stream_buffer(ShlexStream *st, size_t *size)
+{
+    if (st->buffer == NULL) st->buffer = (char*)shlex__realloc(st->lexer.allocator, NULL, 0, SHLEX_STREAM_BUFFER_SIZE);
+    *size = SHLEX_STREAM_BUFFER_SIZE;
+    return st->buffer;
+}
+
+void shlex_stream_commit(ShlexStream *st, size_t size)
+{
+    assert(st->buffer != NULL && size <= SHLEX_STREAM_BUFFER_SIZE);
+    shlex_stream_on_data(st, st->buffer, size);
+}
+
+#ifndef _WIN32
+ShlexStreamStatus shlex_stream_read_fd(ShlexStream *st, int fd)
+{
+    size_t size;
+    char *buffer = shlex_stream_buffer(st, &size);
+    for (;;) {
+        ssize_t n = read(fd, buffer, size);
+        if (n > 0) {
+            shlex_stream_commit(st, n);
+        } else if (n == 0) {
+            shlex_stream_on_eof(st);
+            return SHLEX_STREAM_EOF;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return SHLEX_STREAM_AGAIN;
+        } else if (errno != EINTR) {
+            return SHLEX_STREAM_ERROR;
+        }
+    }
+}
+#endif // _WIN32
+
+void shlex_stream_reset(ShlexStream *st)
+{
+    shlex_reset(&st->lexer);
+    st->starts_count = 0;
+}
+
+void shlex_stream_free(ShlexStream *st)
+{
+    const ShlexAllocator *allocator = st->lexer.allocator;
+    shlex__free(allocator, st->starts, st->starts_capacity*sizeof(*st->starts));
+    shlex__free(allocator, st->items, st->items != NULL ? (st->starts_capacity + 1)*sizeof(*st->items) : 0);
+    shlex__free(allocator, st->buffer, st->buffer != NULL ? SHLEX_STREAM_BUFFER_SIZE : 0);
+    shlex_free(&st->lexer);
+    st->starts = NULL;
+    st->starts_count = 0;
+    st->starts_capacity = 0;
+    st->items = NULL;
+    st->buffer = NULL;
+}
+
+// Hashes 8 bytes at a time, so the long tokens like -D macros are cheap to intern.
+static size_t shlex__hash(const char *str, size_t n)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    for (; n >= 8; str += 8, n -= 8) {
+        uint64_t k;
+        memcpy(&k, str, 8);
+        h = (h ^ k)*0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t k = 0;
+    memcpy(&k, str, n);
+    h = (h ^ k)*0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 29;
+    return (size_t)h;
+}
+
+struct Shlex__Intern_Block {
+    struct Shlex__Intern_Block *next;
+    size_t capacity;
+    size_t count;
+    // The strings follow the header
+};
+
+// Copies str with a NULL-terminator into the newest block, starting a new one if it doesn't fit.
+static const char *shlex__intern_store(ShlexIntern *intern, const char *str, size_t n)
+{
+    struct Shlex__Intern_Block *block = intern->blocks;
+    if (block == NULL || block->capacity - block->count < n + 1) {
+        size_t capacity = n + 1 > SHLEX_INTERN_BLOCK_SIZE ? n + 1 : SHLEX_INTERN_BLOCK_SIZE;
+        block = (struct Shlex__Intern_Block*)shlex__realloc(intern->allocator, NULL, 0, sizeof(*block) + capacity);
+        block->capacity = capacity;
+        block->count = 0;
+        // A string of its own block doesn't leave any room, so the current block keeps being filled
+        if (intern->blocks != NULL && capacity > SHLEX_INTERN_BLOCK_SIZE) {
+            block->next = intern->blocks->next;
+            intern->blocks->next = block;
+        } else {
+            block->next = intern->blocks;
+            intern->blocks = block;
+        }
+    }
+    char *data = (char*)(block + 1) + block->count;
+    memcpy(data, str, n);
+    data[n] = '\0';
+    block->count += n + 1;
+    return data;
+}
+
+// Doubles the hash table putting all of the ids back into it
+static void shlex__intern_grow(ShlexIntern *intern)
+{
+    size_t slots_capacity = intern->slots_capacity == 0 ? 64 : intern->slots_capacity*2;
+    size_t *slots = (size_t*)shlex__realloc(intern->allocator, NULL, 0, slots_capacity*sizeof(*slots));
+    memset(slots, 0, slots_capacity*sizeof(*slots));
+    for (size_t id = 0; id < intern->count; ++id) {
+        size_t i = intern->items[id].hash & (slots_capacity - 1);
+        while (slots[i] != 0) i = (i + 1) & (slots_capacity - 1);
+        slots[i] = id + 1;
+    }
+    shlex__free(intern->allocator, intern->slots, intern->slots_capacity*sizeof(*intern->slots));
+    intern->slots = slots;
+    intern->slots_capacity = slots_capacity;
+}
 
-#ifdef SHLEX_IMPLEMENTATION
+size_t shlex_intern(ShlexIntern *intern, const char *str, size_t n)
+{
+    // Keeping the load factor at most a half, so the probe sequences stay short
+    if (2*(intern->count + 1) > intern->slots_capacity) shlex__intern_grow(intern);
 
-static void shlex__string_append(Shlex *s, char x);
-static bool shlex__contains_unsafe(const char *str, size_t n);
+    size_t hash = shlex__hash(str, n);
+    size_t i = hash & (intern->slots_capacity - 1);
+    for (; intern->slots[i] != 0; i = (i + 1) & (intern->slots_capacity - 1)) {
+        const ShlexInterned *item = &intern->items[intern->slots[i] - 1];
+        if (item->hash == hash && item->size == n && memcmp(item->data, str, n) == 0) return intern->slots[i] - 1;
+    }
 
-void shlex_init(Shlex *s, const char *source, const char *source_end)
-{
-    s->source = source;
-    s->source_end = source_end;
-    s->point = source;
+    if (intern->count >= intern->capacity) {
+        size_t capacity = intern->capacity == 0 ? 64 : intern->capacity*2;
+        intern->items = (ShlexInterned*)shlex__realloc(intern->allocator, intern->items,
+                                                       intern->capacity*sizeof(*intern->items),
+                                                       capacity*sizeof(*intern->items));
+        intern->capacity = capacity;
+    }
+    ShlexInterned *item = &intern->items[intern->count];
+    item->data = shlex__intern_store(intern, str, n);
+    item->size = n;
+    item->hash = hash;
+    intern->slots[i] = ++intern->count;
+    return intern->count - 1;
 }
 
-void shlex_free(Shlex *s)
+bool shlex_next_interned(Shlex *s, ShlexIntern *intern, size_t *id)
 {
-    free(s->string);
-    memset(s, 0, sizeof(*s));
+    const char *ptr;
+    size_t len;
+    if (!shlex_next_view(s, &ptr, &len)) return false;
+    *id = shlex_intern(intern, ptr, len);
+    return true;
 }
 
-char *shlex_next(Shlex *s)
+void shlex_intern_free(ShlexIntern *intern)
 {
-    while (s->point < s->source_end && isspace(*s->point)) {
-        s->point++;
+    const ShlexAllocator *allocator = intern->allocator;
+    while (intern->blocks != NULL) {
+        struct Shlex__Intern_Block *block = intern->blocks;
+        intern->blocks = block->next;
+        shlex__free(allocator, block, sizeof(*block) + block->capacity);
     }
+    shlex__free(allocator, intern->items, intern->capacity*sizeof(*intern->items));
+    shlex__free(allocator, intern->slots, intern->slots_capacity*sizeof(*intern->slots));
+    memset(intern, 0, sizeof(*intern));
+    intern->allocator = allocator;
+}
 
-    if (s->point >= s->source_end) return NULL;
+static void shlex__string_append(Shlex *s, char x)
+{
+    shlex__string_reserve(s, 1);
+    s->string[s->string_count++] = x;
+}
 
-    s->string_count = 0;
-    char strlit = 0;
-    while (s->point < s->source_end) {
-        switch (strlit) {
-        // POSIX.1-2024 - 2.2.2 Single-Quotes
-        // > Enclosing characters in single-quotes ('') shall preserve the literal value of each character within the single-quotes. A single-quote cannot occur within single-quotes.
-        case '\'':
-            if (*s->point == '\'') {
-                strlit = 0;
-            } else {
-                shlex__string_append(s, *s->point);
-            }
-            s->point++;
-            break;
-        // POSIX.1-2024 - 2.2.3 Double-Quotes
-        // > Enclosing characters in double-quotes ("") shall preserve the literal value of all characters within the double-quotes, with the exception of the characters backquote, <dollar-sign>, and <backslash> ...
-        // We only care about <backslash> since <dollar-sign> and backquote is related to semantics of the Shell language. We do a pure lexical analysis.
-        case '"':
-            switch (*s->point) {
-            case '"':
-                strlit = 0;
-                s->point++;
-                break;
-            case '\\':
-                s->point++;
-                // We don't really know what to do with unfinished escape sequences in the context of shlex, so we just interpret the <backslash> literally
-                if (s->point >= s->source_end) {
-                    shlex__string_append(s, '\\');
-                    shlex__string_append(s, '\0');
-                    return s->string;
-                }
+static void shlex__string_append_sized(Shlex *s, const char *str, size_t n)
+{
+    if (n == 0) return;
+    shlex__string_reserve(s, n);
+    memcpy(s->string + s->string_count, str, n);
+    s->string_count += n;
+}
 
-                switch (*s->point) {
-                // POSIX.1-2024 - 2.2.3 Double-Quotes
-                // > <backslash> shall retain its special meaning as an escape character (see 2.2.1 Escape Character (Backslash)) only when immediately followed by one of the following characters $   `   \   <newline> or by a double-quote character that would otherwise be considered special
-                case '$':
-                case '`':
-                case '\\':
-                case '\n':
-                case '"':
-                    shlex__string_append(s, *s->point);
-                    break;
-                default:
-                    shlex__string_append(s, '\\');
-                    shlex__string_append(s, *s->point);
-                }
-                s->point++;
-                break;
-            default:
-                shlex__string_append(s, *s->point);
-                s->point++;
-            }
-            break;
-        case '\0':
-            switch (*s->point) {
-            case '"':
-            case '\'':
-                strlit = *s->point;
-                s->point++;
-                break;
-            // POSIX.1-2024 - 2.2.1 Escape Character (Backslash)
-            // > A <backslash> that is not quoted shall preserve the literal value of the following character, ...
-            case '\\':
-                s->point++;
-                if (s->point < s->source_end) {
-                    shlex__string_append(s, *s->point);
-                    s->point++;
-                }
-                break;
-            default:
-                if (isspace(*s->point)) {
-                    shlex__string_append(s, '\0');
-                    return s->string;
-                }
-                shlex__string_append(s, *s->point);
-                s->point++;
-            }
-            break;
-        default:
-            assert(0 && "UNREACHABLE");
-        }
-    }
+#ifdef SHLEX__SSE2
+// Sets a bit for each byte of v that is either a whitespace, a quote or a <backslash>.
+static inline int shlex__special_mask_sse2(__m128i v)
+{
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),  _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))));
+    // '\t', '\n', '\v', '\f', '\r' occupy the range 0x09..0x0D, so they are checked with a single unsigned comparison
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(4)), x));
+    return _mm_movemask_epi8(special);
+}
+#endif // SHLEX__SSE2
 
-    shlex__string_append(s, '\0');
-    return s->string;
+#ifdef SHLEX__AVX2
+// The AVX2 version of shlex__special_mask_sse2(..)
+static inline unsigned shlex__special_mask_avx2(__m256i v)
+{
+    __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))));
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    special = _mm256_or_si256(special, _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(4)), x));
+    return (unsigned)_mm256_movemask_epi8(special);
 }
+#endif // SHLEX__AVX2
 
-void shlex_reset(Shlex *s)
+#ifdef SHLEX__NEON
+// The NEON version of shlex__special_mask_sse2(..). Returns 4 bits per byte.
+static inline uint64_t shlex__special_mask_neon(uint8x16_t v)
 {
-    s->source = NULL;
-    s->source_end = NULL;
-    s->point = NULL;
-    s->string_count = 0;
-    // Important! Do not touch s->string_capacity and s->string! They are important for reusage of the allocated memory.
+    uint8x16_t special = vorrq_u8(
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')),  vceqq_u8(v, vdupq_n_u8('\\'))),
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8('\'')), vceqq_u8(v, vdupq_n_u8('"'))));
+    special = vorrq_u8(special, vcleq_u8(vsubq_u8(v, vdupq_n_u8('\t')), vdupq_n_u8(4)));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
 }
+#endif // SHLEX__NEON
 
-void shlex_append_quoted(Shlex *s, const char *cstr)
+#ifdef SHLEX__SSE2
+// Sets a bit for each byte of v that is either a quote, a <backslash> or a '\n'.
+static inline int shlex__structural_mask_sse2(__m128i v)
 {
-    shlex_append_quoted_sized(s, cstr, strlen(cstr));
+    return _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),  _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))));
 }
+#endif // SHLEX__SSE2
 
-void shlex_append_quoted_sized(Shlex *s, const char *str, size_t n)
+#ifdef SHLEX__AVX2
+// The AVX2 version of shlex__structural_mask_sse2(..)
+static inline unsigned shlex__structural_mask_avx2(__m256i v)
 {
-    if (s->string_count > 0) shlex__string_append(s, ' ');
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')))));
+}
+#endif // SHLEX__AVX2
 
-    if (n == 0) {
-        shlex__string_append(s, '\'');
-        shlex__string_append(s, '\'');
-        return;
-    }
+#ifdef SHLEX__NEON
+// The NEON version of shlex__structural_mask_sse2(..). Returns 4 bits per byte.
+static inline uint64_t shlex__structural_mask_neon(uint8x16_t v)
+{
+    uint8x16_t structural = vorrq_u8(
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')),  vceqq_u8(v, vdupq_n_u8('\\'))),
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8('\'')), vceqq_u8(v, vdupq_n_u8('"'))));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(structural), 4)), 0);
+}
+#endif // SHLEX__NEON
 
-    if (!shlex__contains_unsafe(str, n)) {
-        for (size_t i = 0; i < n; ++i) {
-            shlex__string_append(s, str[i]);
-        }
-        return;
+// Finds the first quote, <backslash> or '\n' in [p, end). Returns end if there is none.
+// These are the only characters that matter for finding the ends of the lines.
+static const char *shlex__find_structural(const char *p, const char *end)
+{
+#ifdef SHLEX__AVX2
+    while (end - p >= 32) {
+        unsigned mask = shlex__structural_mask_avx2(_mm256_loadu_si256((const __m256i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
     }
+#endif // SHLEX__AVX2
+#ifdef SHLEX__SSE2
+    while (end - p >= 16) {
+        int mask = shlex__structural_mask_sse2(_mm_loadu_si128((const __m128i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif // SHLEX__SSE2
+#ifdef SHLEX__NEON
+    while (end - p >= 16) {
+        uint64_t mask = shlex__structural_mask_neon(vld1q_u8((const uint8_t*)p));
+        if (mask) return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif // SHLEX__NEON
+    while (p < end && *p != '\n' && !shlex__is(*p, SHLEX__CC_QUOTE|SHLEX__CC_ESCAPE)) {
+        p++;
+    }
+    return p;
+}
 
-    shlex__string_append(s, '\'');
-    for (size_t i = 0; i < n; ++i) {
-        if (str[i] == '\'') {
-            shlex__string_append(s, '\'');
-            shlex__string_append(s, '"');
-            shlex__string_append(s, '\'');
-            shlex__string_append(s, '"');
-            shlex__string_append(s, '\'');
-        } else {
-            shlex__string_append(s, str[i]);
-        }
+// Finds the first whitespace, quote or <backslash> in [p, end). Returns end if there is none.
+// This is the hot loop of shlex_next(..) so it is vectorized where possible. Define SHLEX_NO_SIMD to
+// force the scalar version.
+static const char *shlex__find_special(const char *p, const char *end)
+{
+#ifdef SHLEX__AVX2
+    while (end - p >= 32) {
+        unsigned mask = shlex__special_mask_avx2(_mm256_loadu_si256((const __m256i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
     }
-    shlex__string_append(s, '\'');
+#endif // SHLEX__AVX2
+#ifdef SHLEX__SSE2
+    while (end - p >= 16) {
+        int mask = shlex__special_mask_sse2(_mm_loadu_si128((const __m128i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif // SHLEX__SSE2
+#ifdef SHLEX__NEON
+    while (end - p >= 16) {
+        uint64_t mask = shlex__special_mask_neon(vld1q_u8((const uint8_t*)p));
+        if (mask) return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif // SHLEX__NEON
+    while (p < end && !shlex__is(*p, SHLEX__CC_SPACE|SHLEX__CC_QUOTE|SHLEX__CC_ESCAPE)) {
+        p++;
+    }
+    return p;
 }
 
-char *shlex_join(Shlex *s)
+#if defined(SHLEX__SSSE3) || defined(SHLEX__NEON_TBL)
+// The nibble lookup tables of SHLEX__CC_SAFE: a byte is safe iff the entries of its low and high nibbles share a bit.
+// Each high nibble from 0x2 to 0x7 gets its own bit, and the entry of a low nibble has the bits of all the
+// high nibbles that make a safe character with it. 0x80..0xFF are not safe since their high nibbles have no bits.
+static const unsigned char shlex__safe_lo_nibbles[16] = {
+    0x2E, 0x3E, 0x3E, 0x3E, 0x3E, 0x3F, 0x3E, 0x3E, 0x3E, 0x3E, 0x3E, 0x15, 0x15, 0x17, 0x15, 0x1D,
+};
+static const unsigned char shlex__safe_hi_nibbles[16] = {
+    0x00, 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+#endif // SHLEX__SSSE3 || SHLEX__NEON_TBL
+
+#ifdef SHLEX__SSSE3
+// Sets a bit for each byte of v that is not SHLEX__CC_SAFE.
+static inline int shlex__unsafe_mask_ssse3(__m128i v)
 {
-    shlex__string_append(s, '\0');
-    s->string_count = 0; // Resetting the string storage so it can be reused for more shlex_append_quoted[_sized](..)
-    return s->string;
+    __m128i lo_nibbles = _mm_loadu_si128((const __m128i*)shlex__safe_lo_nibbles);
+    __m128i hi_nibbles = _mm_loadu_si128((const __m128i*)shlex__safe_hi_nibbles);
+    __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    __m128i safe = _mm_and_si128(_mm_shuffle_epi8(lo_nibbles, lo), _mm_shuffle_epi8(hi_nibbles, hi));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(safe, _mm_setzero_si128()));
 }
+#endif // SHLEX__SSSE3
 
-static void shlex__string_append(Shlex *s, char x)
+#ifdef SHLEX__AVX2
+// The AVX2 version of shlex__unsafe_mask_ssse3(..)
+static inline unsigned shlex__unsafe_mask_avx2(__m256i v)
 {
-    if (s->string_count >= s->string_capacity) {
-        if (s->string_capacity == 0) {
-            s->string_capacity = 256;
-        } else {
-            s->string_capacity *= 2;
-        }
-        s->string = realloc(s->string, s->string_capacity);
-    }
-    s->string[s->string_count++] = x;
+    __m256i lo_nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)shlex__safe_lo_nibbles));
+    __m256i hi_nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)shlex__safe_hi_nibbles));
+    __m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    __m256i safe = _mm256_and_si256(_mm256_shuffle_epi8(lo_nibbles, lo), _mm256_shuffle_epi8(hi_nibbles, hi));
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(safe, _mm256_setzero_si256()));
 }
+#endif // SHLEX__AVX2
 
-static bool shlex__contains_unsafe(const char *str, size_t n)
+#ifdef SHLEX__NEON_TBL
+// The NEON version of shlex__unsafe_mask_ssse3(..). Returns 4 bits per byte.
+static inline uint64_t shlex__unsafe_mask_neon(uint8x16_t v)
 {
-    for (size_t i = 0; i < n; ++i) {
-        char c = str[i];
-        if (!isalnum(c) && strchr("_@%+=:,./-", c) == NULL) {
-            return true;
-        }
+    uint8x16_t lo = vqtbl1q_u8(vld1q_u8(shlex__safe_lo_nibbles), vandq_u8(v, vdupq_n_u8(0x0F)));
+    uint8x16_t hi = vqtbl1q_u8(vld1q_u8(shlex__safe_hi_nibbles), vshrq_n_u8(v, 4));
+    uint8x16_t unsafe = vceqq_u8(vandq_u8(lo, hi), vdupq_n_u8(0));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(unsafe), 4)), 0);
+}
+#endif // SHLEX__NEON_TBL
+
+// Finds the first character in [p, end) that is not SHLEX__CC_SAFE. Returns end if there is none.
+static const char *shlex__find_unsafe(const char *p, const char *end)
+{
+#ifdef SHLEX__AVX2
+    while (end - p >= 32) {
+        unsigned mask = shlex__unsafe_mask_avx2(_mm256_loadu_si256((const __m256i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
     }
-    return false;
+#endif // SHLEX__AVX2
+#ifdef SHLEX__SSSE3
+    while (end - p >= 16) {
+        int mask = shlex__unsafe_mask_ssse3(_mm_loadu_si128((const __m128i*)p));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif // SHLEX__SSSE3
+#ifdef SHLEX__NEON_TBL
+    while (end - p >= 16) {
+        uint64_t mask = shlex__unsafe_mask_neon(vld1q_u8((const uint8_t*)p));
+        if (mask) return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif // SHLEX__NEON_TBL
+    while (p < end && shlex__is(*p, SHLEX__CC_SAFE)) {
+        p++;
+    }
+    return p;
 }
 
 #endif // SHLEX_IMPLEMENTATION
@@ -280,12 +3212,42 @@ static bool shlex__contains_unsafe(const char *str, size_t n)
 void splitting(void);
 void joining(void);
 void splitting_joined(void);
+void splitting_argv(void);
+void splitting_stream(void);
+void splitting_lines(void);
+void splitting_positions(void);
+void splitting_errors(void);
+void splitting_punctuation(void);
+void splitting_commands(void);
+#ifndef _WIN32
+void splitting_commands_fd(void);
+#endif // _WIN32
+void splitting_interned(void);
+void collecting_stats(void);
+void pooling_lexers(void);
+void growing_storage(void);
+void splitting_file(void);
 
 int main(void)
 {
     splitting();
     joining();
     splitting_joined();
+    splitting_argv();
+    splitting_stream();
+    splitting_lines();
+    splitting_positions();
+    splitting_errors();
+    splitting_punctuation();
+    splitting_commands();
+#ifndef _WIN32
+    splitting_commands_fd();
+#endif // _WIN32
+    splitting_interned();
+    collecting_stats();
+    pooling_lexers();
+    growing_storage();
+    splitting_file();
     return 0;
 }
 
@@ -340,6 +3302,12 @@ void joining(void)
     shlex_append_quoted(&s, "a'b");
     printf("    %s\n", shlex_join(&s));
 
+    s.quoting = SHLEX_QUOTE_MINIMAL;
+    shlex_append_quoted(&s, "SELECT * FROM t WHERE name = 'foo' OR name = 'bar'");
+    shlex_append_quoted(&s, "Hello, World");
+    shlex_append_quoted(&s, "a'b");
+    printf("    %s\n", shlex_join(&s));
+
     printf("\n");
 
     shlex_free(&s);
@@ -365,4 +3333,373 @@ void splitting_joined(void)
     free(source);
 }
 
+void splitting_argv(void)
+{
+    printf("=== SPLITTING ARGV ===\n");
+    const char *source = "cc -o 'hello world' \"hello world.c\" -lm";
+    ShlexArgv argv = {0};
+    shlex_split(source, source + strlen(source), &argv);
+    for (char **item = argv.items; *item != NULL; ++item) {
+        printf("    %s\n", *item);
+    }
+    printf("    (%zu items)\n", argv.count);
+    shlex_argv_free(&argv);
+}
+
+void splitting_stream(void)
+{
+    printf("=== SPLITTING STREAM ===\n");
+    const char *source = "-I\"./raylib/\" -C link-args=\"-L\\\"./hello world\\\" -lm -lc\" -O3";
+    size_t source_len = strlen(source);
+    Shlex s = {0};
+    // Feeding the source in the tiny chunks to make sure the tokens cross their boundaries
+    for (size_t i = 0; i < source_len; i += 4) {
+        size_t n = source_len - i < 4 ? source_len - i : 4;
+        shlex_feed(&s, source + i, n);
+        while (shlex_next(&s)) {
+            printf("    %s\n", s.string);
+        }
+    }
+    shlex_finish(&s);
+    while (shlex_next(&s)) {
+        printf("    %s\n", s.string);
+    }
+    shlex_free(&s);
+}
+
+void splitting_lines(void)
+{
+    printf("=== SPLITTING LINES ===\n");
+    const char *source =
+        "cc -o main main.c\n"
+        "echo 'multi\n"
+        "line'\n"
+        "\n"
+        "rm -rf \"build dir\"\n";
+    ShlexLines lines = {0};
+    shlex_split_lines(source, source + strlen(source), 2, &lines);
+    for (size_t i = 0; i < lines.lines_count; ++i) {
+        printf("    %zu:", i);
+        for (char **item = lines.lines[i]; *item != NULL; ++item) {
+            printf(" [%s]", *item);
+        }
+        printf("\n");
+    }
+    shlex_lines_free(&lines);
+}
+
+void splitting_positions(void)
+{
+    printf("=== SPLITTING POSITIONS ===\n");
+    const char *source =
+        "cc -o main main.c\n"
+        "  echo 'multi\n"
+        "line' \"done\"\n";
+    size_t source_len = strlen(source);
+    Shlex s = {0};
+    s.track_lines = true;
+    // The positions are counted from the beginning of the input no matter how it is chunked
+    for (size_t i = 0; i < source_len; i += 5) {
+        size_t n = source_len - i < 5 ? source_len - i : 5;
+        shlex_feed(&s, source + i, n);
+        while (shlex_next(&s)) {
+            printf("    %zu:%zu [%zu, %zu) %s\n", s.token_line, s.token_column, s.token_start, s.token_end, s.string);
+        }
+    }
+    shlex_finish(&s);
+    while (shlex_next(&s)) {
+        printf("    %zu:%zu [%zu, %zu) %s\n", s.token_line, s.token_column, s.token_start, s.token_end, s.string);
+    }
+    shlex_free(&s);
+}
+
+void splitting_errors(void)
+{
+    printf("=== SPLITTING ERRORS ===\n");
+    static const char *sources[] = {
+        "echo 'hello world'",
+        "echo 'hello world",
+        "echo \"hello 'world'",
+        "echo hello\\",
+    };
+    static const char *errors[] = {
+        [SHLEX_OK] = "ok",
+        [SHLEX_ERROR_UNTERMINATED_SINGLE_QUOTE] = "unterminated single quote",
+        [SHLEX_ERROR_UNTERMINATED_DOUBLE_QUOTE] = "unterminated double quote",
+        [SHLEX_ERROR_TRAILING_BACKSLASH] = "trailing backslash",
+    };
+    size_t sources_count = sizeof(sources)/sizeof(sources[0]);
+    Shlex s = {0};
+    for (size_t i = 0; i < sources_count; ++i) {
+        const char *source = sources[i];
+        shlex_init(&s, source, source + strlen(source));
+        while (shlex_next(&s)) {}
+        printf("    %s: %s at %zu\n", source, errors[s.error], s.error_offset);
+    }
+    shlex_free(&s);
+}
+
+void splitting_punctuation(void)
+{
+    printf("=== SPLITTING PUNCTUATION ===\n");
+    static const char *sources[] = {
+        "make && ./main | tee log # build and run",
+        "(cd build;make)>out 2>&1",
+        "echo '#not a comment' \\# \\&\\& \"a&&b\"",
+        "a#b c\nd",
+    };
+    size_t sources_count = sizeof(sources)/sizeof(sources[0]);
+    Shlex s = {0};
+    s.comments = true;
+    s.punctuation = true;
+    for (size_t i = 0; i < sources_count; ++i) {
+        const char *source = sources[i];
+        shlex_init(&s, source, source + strlen(source));
+        printf("   ");
+        while (shlex_next(&s)) {
+            printf(" [%s]", s.string);
+        }
+        printf("\n");
+    }
+    shlex_free(&s);
+}
+
+static void print_command(void *ctx, char **argv, size_t argc)
+{
+    (void) ctx;
+    printf("   ");
+    for (size_t i = 0; i < argc; ++i) {
+        printf(" [%s]", argv[i]);
+    }
+    printf("\n");
+}
+
+void splitting_commands(void)
+{
+    printf("=== SPLITTING COMMANDS ===\n");
+    const char *source =
+        "git commit -m 'multi\n"
+        "line message'\n"
+        "\n"
+        "ls -la # list everything\n"
+        "echo done";
+    size_t source_len = strlen(source);
+    ShlexStream st;
+    shlex_stream_init(&st, print_command, NULL);
+    st.lexer.comments = true;
+    // The pieces of the input may cut it anywhere as they would over a connection
+    for (size_t i = 0; i < source_len; i += 7) {
+        size_t n = source_len - i < 7 ? source_len - i : 7;
+        shlex_stream_on_data(&st, source + i, n);
+    }
+    shlex_stream_on_eof(&st);
+    shlex_stream_free(&st);
+}
+
+#ifndef _WIN32
+void splitting_commands_fd(void)
+{
+    printf("=== SPLITTING COMMANDS FD ===\n");
+    static const char *pieces[] = {
+        "git commit -m 'multi\n",
+        "line message'\nls -la\n",
+        "echo do",
+        "ne",
+    };
+    static const char *statuses[] = {
+        [SHLEX_STREAM_AGAIN] = "again",
+        [SHLEX_STREAM_EOF] = "eof",
+        [SHLEX_STREAM_ERROR] = "error",
+    };
+    size_t pieces_count = sizeof(pieces)/sizeof(pieces[0]);
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("    could not create the pipe\n");
+        return;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    ShlexStream st;
+    shlex_stream_init(&st, print_command, NULL);
+    // Each piece arrives as the event loop would see it, and the stream reads until the pipe is empty
+    printf("    %s\n", statuses[shlex_stream_read_fd(&st, fds[0])]);
+    for (size_t i = 0; i < pieces_count; ++i) {
+        if (write(fds[1], pieces[i], strlen(pieces[i])) < 0) break;
+        printf("    %s\n", statuses[shlex_stream_read_fd(&st, fds[0])]);
+    }
+    // Closing the writing end completes the last command line
+    close(fds[1]);
+    printf("    %s\n", statuses[shlex_stream_read_fd(&st, fds[0])]);
+    close(fds[0]);
+    shlex_stream_free(&st);
+}
+#endif // _WIN32
+
+void splitting_interned(void)
+{
+    printf("=== SPLITTING INTERNED ===\n");
+    const char *source =
+        "cc -O2 -I/usr/include -c foo.c\n"
+        "cc -O2 -I/usr/include -c bar.c\n"
+        "cc '-O2' -I\"/usr/include\" -c baz.c\n";
+    Shlex s = {0};
+    ShlexIntern intern = {0};
+    size_t id;
+    shlex_init(&s, source, source + strlen(source));
+    printf("   ");
+    while (shlex_next_interned(&s, &intern, &id)) {
+        printf(" %zu", id);
+    }
+    printf("\n");
+    for (size_t i = 0; i < intern.count; ++i) {
+        printf("    %zu: %s\n", i, intern.items[i].data);
+    }
+    shlex_intern_free(&intern);
+    shlex_free(&s);
+}
+
+void collecting_stats(void)
+{
+    printf("=== COLLECTING STATS ===\n");
+    // The last token is too long for the inline buffer, so it has to go to the heap
+    const char *source = "cc -o 'hello world' \"hello world.c\" -DMESSAGE=\"a message which is long enough to leave the inline buffer of the lexer\"";
+    static ShlexQuoteCache cache = {0};
+    Shlex s = {0};
+    s.quote_cache = &cache;
+    shlex_init(&s, source, source + strlen(source));
+    while (shlex_next(&s)) {}
+
+    // "bar baz" needs quoting, so its second time comes from the cache. The counters are not reset.
+    shlex_reset(&s);
+    shlex_append_quoted(&s, "foo");
+    shlex_append_quoted(&s, "bar baz");
+    shlex_append_quoted(&s, "bar baz");
+    printf("    %s\n", shlex_join(&s));
+
+    ShlexStats stats = shlex_stats(&s);
+    printf("    bytes_scanned:      %zu\n", stats.bytes_scanned);
+    printf("    tokens:             %zu\n", stats.tokens);
+    printf("    unescaped_tokens:   %zu\n", stats.unescaped_tokens);
+    printf("    reallocs:           %zu\n", stats.reallocs);
+    printf("    peak_capacity:      %zu\n", stats.peak_capacity);
+    printf("    quoted_args:        %zu\n", stats.quoted_args);
+    printf("    bare_args:          %zu\n", stats.bare_args);
+    printf("    quote_cache_hits:   %zu\n", stats.quote_cache_hits);
+    printf("    quote_cache_misses: %zu\n", stats.quote_cache_misses);
+    shlex_free(&s);
+    shlex_quote_cache_free(&cache);
+}
+
+void pooling_lexers(void)
+{
+    printf("=== POOLING LEXERS ===\n");
+    ShlexPool pool;
+    shlex_pool_init(&pool, 256, NULL);
+    char token[1000];
+
+    // A token under high_water leaves the storage in place for the next acquire
+    Shlex *s = shlex_pool_acquire(&pool);
+    memset(token, 'a', 200);
+    shlex_init(s, token, token + 200);
+    while (shlex_next(s)) {}
+    printf("    after 200 bytes:  capacity %zu\n", s->string_capacity);
+    shlex_pool_release(&pool, s);
+    Shlex *t = shlex_pool_acquire(&pool);
+    printf("    acquired again:   capacity %zu, %s lexer\n", t->string_capacity, t == s ? "same" : "another");
+
+    // A token over high_water does not pin its storage in the pool
+    memset(token, 'b', sizeof(token));
+    shlex_init(t, token, token + sizeof(token));
+    while (shlex_next(t)) {}
+    printf("    after 1000 bytes: capacity %zu\n", t->string_capacity);
+    shlex_pool_release(&pool, t);
+    s = shlex_pool_acquire(&pool);
+    printf("    acquired again:   capacity %zu, %s lexer, %s storage\n", s->string_capacity, t == s ? "same" : "another",
+           s->string == s->inline_string ? "inline" : "heap");
+    shlex_pool_release(&pool, s);
+    shlex_pool_free(&pool);
+}
+
+void growing_storage(void)
+{
+    printf("=== GROWING STORAGE ===\n");
+    static const size_t sizes[] = {80, 300, 2000};
+    size_t sizes_count = sizeof(sizes)/sizeof(sizes[0]);
+    char arg[2000];
+    memset(arg, 'x', sizeof(arg));
+    Shlex s = {0};
+    s.growth.initial = 100;
+    s.growth.percent = 50;
+    s.growth.max_step = 256;
+    s.growth.trim_above = 1000;
+
+    // Grows by half at a time until the steps hit max_step, and linearly by max_step from then on
+    for (size_t i = 0; i < sizes_count; ++i) {
+        shlex_append_quoted_sized(&s, arg, sizes[i]);
+        printf("    after %zu bytes: capacity %zu\n", sizes[i], s.string_capacity);
+        shlex_join(&s);
+    }
+
+    // Shrinking never goes below what the storage holds
+    shlex_append_quoted_sized(&s, arg, 500);
+    shlex_shrink(&s, 0);
+    printf("    shrunk with 500 bytes: capacity %zu\n", s.string_capacity);
+    shlex_join(&s);
+    shlex_shrink(&s, 0);
+    printf("    shrunk empty: capacity %zu, %s storage\n", s.string_capacity, s.string == s.inline_string ? "inline" : "heap");
+
+    shlex_append_quoted_sized(&s, arg, 500);
+    shlex_join(&s);
+    shlex_reset(&s);
+    printf("    reset under trim_above: capacity %zu\n", s.string_capacity);
+    shlex_append_quoted_sized(&s, arg, 2000);
+    shlex_join(&s);
+    shlex_reset(&s);
+    printf("    reset over trim_above: capacity %zu, %s storage\n", s.string_capacity, s.string == s.inline_string ? "inline" : "heap");
+    shlex_free(&s);
+}
+
+void splitting_file(void)
+{
+    printf("=== SPLITTING FILE ===\n");
+    const char *path = "shlex_self_test.tmp";
+    static const char *contents[] = {
+        "cc -o main main.c\n"
+        "echo 'hello world'\n"
+        "\n"
+        "rm -rf \"build dir\"",
+        // Empty files are not mapped at all and just have no lines
+        "",
+    };
+    size_t contents_count = sizeof(contents)/sizeof(contents[0]);
+    Shlex s = {0};
+    ShlexFile f;
+    for (size_t i = 0; i < contents_count; ++i) {
+        if (i > 0) printf("---\n");
+        FILE *out = fopen(path, "wb");
+        fputs(contents[i], out);
+        fclose(out);
+
+        if (!shlex_open_file(&f, path)) {
+            printf("    could not open %s\n", path);
+            continue;
+        }
+        size_t lines = 0;
+        while (shlex_next_line(&f, &s)) {
+            printf("    %zu:", lines++);
+            while (shlex_next(&s)) {
+                printf(" [%s]", s.string);
+            }
+            printf("\n");
+        }
+        printf("    (%zu lines)\n", lines);
+        shlex_close_file(&f);
+    }
+    remove(path);
+
+    // The file is gone now, so opening it fails with errno set
+    printf("---\n");
+    printf("    %s: %s\n", path, shlex_open_file(&f, path) ? "opened" : "could not open");
+    shlex_free(&s);
+}
+
 #endif // SHLEX_SELF_TEST
@@ -0,0 +1,165 @@
+// Checks of the C++ layer of shlex.h. The compile-time splitting and quoting are checked by the compiler
+// itself with static_assert(..), and against the C implementation on random inputs at runtime.
+//
+// $ make shlex_cpp
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#define SHLEX_IMPLEMENTATION
+#include "shlex.h"
+
+static void expect(bool condition, const char *what)
+{
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        abort();
+    }
+}
+
+// Only <backslash> before $ ` \ " and the newline is an escape inside of the double-quotes
+constexpr auto double_quoted = shlex::static_split("\"\\$ \\` \\\\ \\\" \\x\" a\\b");
+static_assert(double_quoted.size() == 2);
+static_assert(double_quoted[0] == "$ ` \\ \" \\x");
+static_assert(double_quoted[1] == "ab");
+
+// The trailing <backslash> is kept inside of the double-quotes and dropped outside of them
+constexpr auto trailing_in_quotes = shlex::static_split("a \"b\\");
+static_assert(trailing_in_quotes.size() == 2);
+static_assert(trailing_in_quotes[0] == "a");
+static_assert(trailing_in_quotes[1] == "b\\");
+constexpr auto trailing = shlex::static_split("c\\");
+static_assert(trailing.size() == 1 && trailing[0] == "c");
+
+constexpr auto empty_tokens = shlex::static_split("'' a ''\"\"");
+static_assert(empty_tokens.size() == 3);
+static_assert(empty_tokens[0] == "" && empty_tokens[1] == "a" && empty_tokens[2] == "");
+static_assert(empty_tokens.c_str(0)[0] == '\0');
+static_assert(shlex::static_split("").size() == 0);
+static_assert(shlex::static_split(" \t\n").size() == 0);
+
+static_assert(shlex::static_quote("").view() == "''");
+static_assert(shlex::static_quote("it's").view() == "'it'\"'\"'s'");
+static_assert(shlex::static_quote("-I/usr/include").view() == "-I/usr/include");
+static_assert(shlex::static_quote("a b").view() == "'a b'");
+
+static unsigned long long rng_state = 0x5EED;
+
+static unsigned rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned)rng_state;
+}
+
+// Runs static_split(..) and static_quote(..) on random arrays of N bytes and compares them with
+// shlex_next(..) and shlex_append_quoted_sized(..). The arrays end with a NULL-terminator like the literals do.
+template <std::size_t N>
+static void check_random(size_t iterations)
+{
+    static const char alphabet[] = "ab '\"\\\n\t$`";
+    Shlex s;
+    memset(&s, 0, sizeof(s));
+    for (size_t i = 0; i < iterations; ++i) {
+        char source[N];
+        for (std::size_t j = 0; j + 1 < N; ++j) source[j] = alphabet[rng()%(sizeof(alphabet) - 1)];
+        source[N - 1] = '\0';
+
+        auto argv = shlex::static_split(source);
+        shlex_init(&s, source, source + N - 1);
+        std::size_t count = 0;
+        while (shlex_next(&s)) {
+            expect(count < argv.size(), "static_split count");
+            expect(argv[count] == std::string_view(s.string, s.string_count - 1), "static_split token");
+            count += 1;
+        }
+        expect(count == argv.size(), "static_split count");
+
+        auto quoted = shlex::static_quote(source);
+        shlex_reset(&s);
+        shlex_append_quoted_sized(&s, source, N - 1);
+        expect(quoted.view() == std::string_view(shlex_join(&s)), "static_quote");
+    }
+    shlex_free(&s);
+}
+
+static void check_lexer(void)
+{
+    shlex::Lexer lexer("a 'b c' \"d\\\"e\"");
+    std::vector<std::string> tokens;
+    for (std::string_view token : lexer) tokens.emplace_back(token);
+    expect(tokens == std::vector<std::string>{"a", "b c", "d\"e"}, "Lexer iteration");
+
+    // Both tokens are unquoted into the string storage, so the second one overwrites the first
+    lexer.reset("'x y' 'z w'");
+    shlex::Lexer::iterator it = lexer.begin();
+    std::string first(*it++);
+    expect(first == "x y", "*it++ of Lexer::iterator");
+    expect(*it == "z w", "Lexer::iterator after it++");
+    it++;
+    expect(it == lexer.end(), "Lexer::iterator end");
+
+    // The first token is short enough to stay in the inline buffer which has to move along with the lexer
+    shlex::Lexer a("'ab' cd");
+    std::string_view token;
+    expect(a.next(token) && token == "ab", "Lexer::next");
+    expect(a.get()->string == a.get()->inline_string, "inline string storage");
+    shlex::Lexer b(std::move(a));
+    expect(b.get()->string == b.get()->inline_string, "Lexer move keeps the inline storage");
+    expect(std::string_view(b.get()->string) == "ab", "Lexer move keeps the token");
+    expect(b.next(token) && token == "cd", "Lexer move keeps the position");
+    expect(!b.next(token), "Lexer move keeps the end");
+    expect(!a.next(token), "moved from Lexer is empty");
+
+    shlex::Lexer c;
+    std::string_view joined = c.join(std::vector<std::string_view>{"a b"});
+    expect(joined == "'a b'", "Lexer::join");
+    shlex::Lexer d;
+    d = std::move(c);
+    expect(d.get()->string == d.get()->inline_string, "Lexer move assignment keeps the inline storage");
+    expect(std::string_view(d.get()->string) == "'a b'", "Lexer move assignment keeps the joined string");
+}
+
+// Yields a shorter argument on the second pass, like a range over something that changes under it
+struct Changing_Range {
+    std::string_view first[1] = {"a long argument"};
+    std::string_view second[1] = {"b"};
+    mutable int passes = 0;
+
+    const std::string_view *begin() const { return ++passes == 1 ? first : second; }
+    const std::string_view *end() const { return (passes == 1 ? first : second) + 1; }
+};
+
+static void check_join(void)
+{
+    expect(shlex::join(std::vector<std::string>{"a", "b c", "it's", ""}) == "a 'b c' 'it'\"'\"'s' ''", "join of strings");
+    expect(shlex::join(std::vector<std::string_view>{"-C", "link-args=-lm -L."}) == "-C 'link-args=-lm -L.'", "join of views");
+    expect(shlex::join(std::vector<std::string>{}) == "", "join of nothing");
+
+    shlex::Lexer lexer;
+    lexer.get()->quoting = SHLEX_QUOTE_MINIMAL;
+    expect(lexer.join(std::vector<std::string>{"it's", "a b"}) == "it\\'s a\\ b", "Lexer::join with the minimal quoting");
+
+    // The view covers what the second pass appended, not what the first one measured
+    expect(lexer.join(Changing_Range{}) == "b", "Lexer::join of a range changing between the passes");
+
+    // Longer than the inline buffer, so the exact size computed upfront is what gets allocated
+    std::string long_arg(1000, 'x');
+    long_arg += " y";
+    expect(shlex::join(std::vector<std::string>{long_arg}) == "'" + long_arg + "'", "join of a long argument");
+}
+
+int main()
+{
+    check_lexer();
+    check_join();
+    check_random<1>(1);
+    check_random<2>(100);
+    check_random<5>(10000);
+    check_random<17>(10000);
+    check_random<64>(10000);
+    printf("OK\n");
+    return 0;
+}